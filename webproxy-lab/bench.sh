@@ -0,0 +1,137 @@
+#!/bin/bash
+#
+# bench.sh - Throughput benchmark for the proxy. Starts Tiny as the
+#     origin, then runs the proxy under each concurrency mode and
+#     drives it with ./loadgen, printing requests/sec for each mode.
+#
+#     Two workloads are measured per mode:
+#       hit   - home.html, warmed into the cache first
+#       relay - a generated file larger than MAX_OBJECT_SIZE, so every
+#               request is relayed from the origin
+#     The sys/req column is the number of I/O system calls the proxy
+#     made per request: read/write calls from /proc/<pid>/io plus the
+#     io_uring_enter calls the proxy reports on SIGUSR1 (splice calls
+#     are not counted). cpu_ms/MB is the proxy's user+system CPU time
+#     per megabyte delivered, from /proc/<pid>/stat.
+#
+#     usage: ./bench.sh [conns] [secs]
+#
+#     BENCH_MODES overrides the list of proxy invocations to compare,
+#     e.g. BENCH_MODES="-mthread -mpool" ./bench.sh 64 10
+#     BENCH_LOADGEN adds loadgen flags, e.g. BENCH_LOADGEN=-k to reuse
+#     client connections (HTTP/1.1 keep-alive) instead of one per request.
+#
+
+CONNS=${1:-32}
+SECS=${2:-5}
+HOME_DIR=`pwd`
+HIT_FILE="home.html"
+RELAY_FILE="bench-relay.bin"
+RELAY_KB=1024
+LOG=/tmp/bench-proxy.$$
+LOADGEN_FLAGS=${BENCH_LOADGEN:-}
+
+# Each entry is one set of proxy flags (no spaces inside an entry)
+MODES=${BENCH_MODES:-"-mthread -mpool,-n4 -mpool,-n16 -mpool,-n64 -mpool,-S -mepoll -mepoll,-R -muring"}
+
+#
+# free_port - returns an available unused TCP port
+#
+function free_port {
+    ./free-port.sh
+}
+
+#
+# wait_for_port_use - Spins until the TCP port is being listened on
+#
+function wait_for_port_use() {
+    for i in `seq 1 50`
+    do
+        netstat --numeric-ports --numeric-hosts -a --protocol=tcpip \
+            | grep LISTEN | grep -q ":${1} " && return
+        sleep 0.1
+    done
+    echo "Timeout waiting for port ${1}"
+    exit 1
+}
+
+#
+# proxy_syscalls - read/write syscalls + io_uring_enter calls so far
+# usage: proxy_syscalls <pid>
+#
+function proxy_syscalls() {
+    kill -USR1 $1
+    sleep 0.2
+    rw=`awk '/^sysc[rw]:/ {s += $2} END {print s}' /proc/$1/io`
+    enters=`grep -ao 'uring_enters=[0-9]*' ${LOG} | tail -1 | cut -d= -f2`
+    echo $(( rw + ${enters:-0} ))
+}
+
+#
+# cpu_ms - user+system CPU time of a process so far, in milliseconds
+# usage: cpu_ms <pid>
+#
+function cpu_ms() {
+    awk -v hz=`getconf CLK_TCK` '{print int(($14 + $15) * 1000 / hz)}' /proc/$1/stat
+}
+
+if [ ! -x ./proxy ] || [ ! -x ./loadgen ]
+then
+    echo "Error: build ./proxy and ./loadgen first (make)."
+    exit 1
+fi
+if [ ! -x ./tiny/tiny ]
+then
+    (cd ./tiny; make)
+fi
+
+killall -q proxy tiny 2> /dev/null
+
+dd if=/dev/urandom of=./tiny/${RELAY_FILE} bs=1024 count=${RELAY_KB} 2> /dev/null
+
+tiny_port=$(free_port)
+cd ./tiny
+./tiny ${tiny_port} &> /dev/null &
+tiny_pid=$!
+cd ${HOME_DIR}
+wait_for_port_use "${tiny_port}"
+
+echo "origin: localhost:${tiny_port}  conns=${CONNS} secs=${SECS} loadgen=${LOADGEN_FLAGS:-none}"
+
+for mode in ${MODES}
+do
+    flags=`echo ${mode} | tr ',' ' '`
+    for file in ${HIT_FILE} ${RELAY_FILE}
+    do
+        URL="http://localhost:${tiny_port}/${file}"
+        proxy_port=$(free_port)
+        ./proxy ${flags} ${proxy_port} > ${LOG} 2>&1 &
+        proxy_pid=$!
+        wait_for_port_use "${proxy_port}"
+
+        # Warm the cache so every measured hit request is a proxy-side hit
+        curl --silent --max-time 5 --proxy http://localhost:${proxy_port} ${URL} > /dev/null
+
+        before=$(proxy_syscalls ${proxy_pid})
+        cpu_before=$(cpu_ms ${proxy_pid})
+        result=`./loadgen ${LOADGEN_FLAGS} -c ${CONNS} -d ${SECS} localhost ${proxy_port} ${URL}`
+        cpu_after=$(cpu_ms ${proxy_pid})
+        after=$(proxy_syscalls ${proxy_pid})
+        reqs=`echo ${result} | sed 's/.*requests=\([0-9]*\).*/\1/'`
+        mb=`echo ${result} | awk '{for (i = 1; i <= NF; i++) {split($i, kv, "="); v[kv[1]] = kv[2]} print v["MB/s"] * v["secs"]}'`
+
+        [ "${file}" == "${HIT_FILE}" ] && load="hit" || load="relay"
+        printf "%-16s %-6s %s sys/req=%s cpu_ms/MB=%s\n" "${flags}" "${load}" "${result}" \
+            `awk -v d=$(( after - before )) -v n=${reqs} 'BEGIN {printf "%.1f", n ? d / n : 0}'` \
+            `awk -v c=$(( cpu_after - cpu_before )) -v m=${mb} 'BEGIN {printf "%.2f", m ? c / m : 0}'`
+
+        kill $proxy_pid 2> /dev/null
+        wait $proxy_pid 2> /dev/null
+    done
+done
+
+kill $tiny_pid 2> /dev/null
+wait $tiny_pid 2> /dev/null
+rm -f ./tiny/${RELAY_FILE} ${LOG}
+
+exit 0
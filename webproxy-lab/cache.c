@@ -0,0 +1,608 @@
+/*
+ * cache.c - 프록시 웹 객체 캐시
+ *
+ * 블록 찾기는 해시 인덱스로 한다 (uri를 블록마다 strcmp 하던 걸 대신함).
+ *  - 키 해시 : uri의 64비트 FNV-1a. 블록에 저장해 두고 다시 계산하지 않는다
+ *  - 인덱스 : open addressing (linear probing). 슬롯에 해시를 같이 둬서 해시가 같을 때만 strcmp
+ *  - 늘릴 때 : 새 표를 만들고 옛 표에서 연산마다 HIDX_MIGRATE 슬롯씩 옮긴다 (incremental resize).
+ *    한 번에 전부 rehash 하느라 락을 오래 잡는 일이 없다
+ *
+ * 항목은 참조 카운트로 관리한다. 캐시 자신이 참조 하나를 들고 있고, cache_get이 하나 더 잡는다.
+ * 적중한 쓰레드는 락을 풀고 항목 저장소에서 바로 클라이언트로 쓴 뒤 cache_put.
+ * 교체될 때는 인덱스에서 빼고 캐시의 참조만 놓는다. 마지막으로 놓는 쪽이 free
+ *
+ * 고정 블록 10개가 아니라 바이트 예산(-c, 기본 MAX_CACHE_SIZE)으로 관리한다.
+ * 예산만큼의 아레나를 슬랩 할당기(slab.c)가 크기 클래스별로 나눠 주고, 그 클래스에 자리가 없으면
+ * LRU 항목을 내보낸다. 작은 객체는 예산이 허락하는 만큼 얼마든지 들어간다
+ *
+ * 누구를 내보낼지는 교체 정책(policy.c, -p)이 항목에 박힌(intrusive) 리스트로 정한다.
+ * 적중이 리스트를 고치는 정책(lru, tinylfu, arc)은 적중도 쓰기 락, 항목의 빈도만 올리는
+ * 정책(clock, s3fifo)은 읽기 락으로 충분하다
+ *
+ * 캐시는 키 해시의 윗 비트로 고르는 샤드 N개(-s)로 나뉜다. 샤드마다 락, 인덱스, 정책 상태,
+ * 예산(전체 / N)이 따로라서 다른 샤드의 키끼리는 서로 안 막는다. 슬랩 아레나만 같이 쓴다
+ *
+ * 같은 uri의 미스가 동시에 여러 개 오면 원 서버에는 하나(leader)만 간다 (single-flight).
+ * 샤드마다 진행 중인 가져오기(flight) 목록이 있고, leader는 응답을 flight의 버퍼에 채우면서
+ * 채운 위치(filled)를 알린다. 나머지는 flight에 붙어서 채워지는 대로 자기 클라이언트로 보낸다
+ * (streaming fill). 캐시에는 leader가 다 받은 뒤에 들어간다
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "cache.h"
+#include "slab.h"
+#include "policy.h"
+#include "fresh.h"
+
+#define HIDX_INIT_CAP  16    // 인덱스 처음 슬롯 수 (2의 거듭제곱)
+#define HIDX_MIGRATE   8     // 연산 한 번에 옛 표에서 옮기는 슬롯 수
+
+#define FLIGHT_WAIT_SECS 30  // leader가 원 서버에서 이만큼 아무것도 못 받으면 붙은 쪽은 포기하고 각자 가져온다
+
+#define HASH_EMPTY     0     // 슬롯 해시값 0 : 빈 슬롯, 1 : 지운 슬롯 (tombstone)
+#define HASH_DELETED   1
+
+// 인덱스 슬롯 : 해시값(0, 1은 예약)과 항목
+typedef struct {
+  uint64_t hash;
+  cache_entry *blk;
+} hslot;
+
+typedef struct {
+  hslot *slots;
+  size_t cap;         // 슬롯 수 (2의 거듭제곱)
+  size_t used;        // 살아 있는 슬롯 + tombstone (probe 길이를 결정)
+  size_t live;
+} htable;
+
+// 해시 인덱스. 늘리는 중이면 old에 옛 표가 남아 있고 migrate까지 옮겼다
+typedef struct {
+  htable cur, old;
+  size_t migrate;
+} hindex;
+
+// 캐시 샤드. 샤드끼리 캐시 라인을 나눠 쓰지 않게 64바이트 정렬
+typedef struct {
+  size_t current_size;      // 이 샤드에 들어 있는 항목들의 size의 합 (budget을 벗어나면 안됨.)
+  size_t budget;            // 전체 예산 / 샤드 수
+  policy_state *ps;         // 교체 정책 상태
+  hindex index;             // uri -> 항목
+  pthread_rwlock_t cache_m;     // shared_hit 정책의 적중만 읽기 락, 나머지는 쓰기 락
+  flight *flights;          // 진행 중인 가져오기
+  pthread_mutex_t flight_m;     // flights 목록과 그 flight들의 state, filled, waiters
+} __attribute__((aligned(64))) cache_shard;
+
+// 캐시 집합체
+typedef struct {
+  const cache_policy *pol;      // 교체 정책
+  int nshards;
+  cache_shard *shards;
+} cache;
+
+// 전역 캐시
+static cache g_cache;
+
+/* 64비트 FNV-1a. 0과 1은 슬롯 표시용이라 피한다 */
+uint64_t cache_hash(const char *key) {
+  uint64_t h = 14695981039346656037ULL;
+
+  while (*key) {
+    h ^= (unsigned char)*key++;
+    h *= 1099511628211ULL;
+  }
+  return h > HASH_DELETED ? h : h + 2;
+}
+
+static void htable_init(htable *t, size_t cap) {
+  t->slots = Calloc(cap, sizeof(hslot));
+  t->cap = cap;
+  t->used = 0;
+  t->live = 0;
+}
+
+/* t에서 (hash, uri) 슬롯. 없으면 NULL */
+static hslot *htable_find(htable *t, uint64_t hash, const char *uri) {
+  if (!t->slots) {
+    return NULL;
+  }
+  for (size_t i = hash & (t->cap - 1); ; i = (i + 1) & (t->cap - 1)) {
+    hslot *s = &t->slots[i];
+    if (s->hash == HASH_EMPTY) {
+      return NULL;
+    }
+    if (s->hash == hash && !strcmp(s->blk->uri, uri)) {
+      return s;
+    }
+  }
+}
+
+/* 키가 t에 없다는 걸 아는 상태에서 넣는다. 첫 빈 슬롯이나 tombstone에 */
+static void htable_put(htable *t, uint64_t hash, cache_entry *blk) {
+  for (size_t i = hash & (t->cap - 1); ; i = (i + 1) & (t->cap - 1)) {
+    hslot *s = &t->slots[i];
+    if (s->hash == HASH_EMPTY || s->hash == HASH_DELETED) {
+      if (s->hash == HASH_EMPTY) {
+        t->used++;
+      }
+      s->hash = hash;
+      s->blk = blk;
+      t->live++;
+      return;
+    }
+  }
+}
+
+static void htable_del(htable *t, hslot *s) {
+  s->hash = HASH_DELETED;
+  s->blk = NULL;
+  t->live--;
+}
+
+/* 옛 표에서 n 슬롯을 새 표로 옮긴다. 다 옮기면 옛 표를 버림.
+   옮긴 슬롯은 옛 표에서 tombstone으로 만든다. 남겨 두면 새 표에서 빼거나 내보낸 항목을
+   옛 표에서 다시 찾게 된다 (이미 해제된 항목) */
+static void hindex_migrate(hindex *ix, size_t n) {
+  htable *old = &ix->old;
+
+  while (old->slots && n-- > 0) {
+    hslot *s = &old->slots[ix->migrate++];
+    if (s->hash > HASH_DELETED) {
+      htable_put(&ix->cur, s->hash, s->blk);
+      htable_del(old, s);
+    }
+    if (ix->migrate == old->cap) {
+      Free(old->slots);
+      memset(old, 0, sizeof(*old));
+    }
+  }
+}
+
+static void hindex_init(hindex *ix) {
+  memset(ix, 0, sizeof(*ix));
+  htable_init(&ix->cur, HIDX_INIT_CAP);
+}
+
+static cache_entry *hindex_find(hindex *ix, uint64_t hash, const char *uri) {
+  hslot *s = htable_find(&ix->cur, hash, uri);
+
+  if (!s) {
+    s = htable_find(&ix->old, hash, uri);
+  }
+  return s ? s->blk : NULL;
+}
+
+/* 새 키를 넣는다. 3/4 넘게 차면 두 배 표를 만들어 옮기기 시작 (tombstone이 많으면 같은 크기로) */
+static void hindex_insert(hindex *ix, uint64_t hash, cache_entry *blk) {
+  hindex_migrate(ix, HIDX_MIGRATE);
+  if ((ix->cur.used + 1) * 4 > ix->cur.cap * 3) {
+    hindex_migrate(ix, ix->old.cap);     // 이전 resize가 안 끝났으면 마저
+    ix->old = ix->cur;
+    ix->migrate = 0;
+    htable_init(&ix->cur, ix->old.live * 2 >= ix->old.cap ? ix->old.cap * 2 : ix->old.cap);
+  }
+  htable_put(&ix->cur, hash, blk);
+}
+
+static void hindex_remove(hindex *ix, uint64_t hash, const char *uri) {
+  hslot *s = htable_find(&ix->cur, hash, uri);
+
+  if (s) {
+    htable_del(&ix->cur, s);
+  }
+  else if ((s = htable_find(&ix->old, hash, uri)) != NULL) {
+    htable_del(&ix->old, s);
+  }
+  hindex_migrate(ix, HIDX_MIGRATE);
+}
+
+/* e가 hash 자리에 들어 있는지. 포인터만 비교하고 항목 내용은 안 읽는다 */
+static int hindex_has(hindex *ix, uint64_t hash, cache_entry *e) {
+  htable *tabs[2] = { &ix->cur, &ix->old };
+
+  for (int t = 0; t < 2; t++) {
+    htable *tb = tabs[t];
+    for (size_t i = hash & (tb->cap - 1); tb->slots && tb->slots[i].hash != HASH_EMPTY;
+         i = (i + 1) & (tb->cap - 1)) {
+      if (tb->slots[i].blk == e) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* 인덱스는 해시의 아랫 비트를 쓰니 샤드는 윗 비트로 고른다 */
+static cache_shard *shard_of(uint64_t hash) {
+  return &g_cache.shards[(hash >> 32) % g_cache.nshards];
+}
+
+static void cache_insert(cache_shard *sh, cache_entry *e);
+
+/* budget : 캐시 전체 바이트 예산 (슬랩 아레나 크기), policy : 교체 정책, nshards : 샤드 수.
+   샤드 예산이 MAX_OBJECT_SIZE보다 작아지지 않게 샤드 수를 줄인다 */
+void cache_init(size_t budget, int policy, int nshards) {
+  void *p;
+
+  while (nshards > 1 && budget / nshards < MAX_OBJECT_SIZE) {
+    nshards--;
+  }
+  slab_init(budget);
+  g_cache.pol = policy_get(policy);
+  g_cache.nshards = nshards;
+  if (posix_memalign(&p, 64, nshards * sizeof(cache_shard)) != 0) {
+    unix_error("posix_memalign error");
+  }
+  g_cache.shards = p;
+  for (int i = 0; i < nshards; i++) {
+    cache_shard *sh = &g_cache.shards[i];
+    sh->current_size = 0;
+    sh->budget = budget / nshards;
+    sh->ps = g_cache.pol->init(sh->budget);
+    hindex_init(&sh->index);
+    pthread_rwlock_init(&sh->cache_m, NULL);
+    sh->flights = NULL;
+    pthread_mutex_init(&sh->flight_m, NULL);
+  }
+}
+
+/*
+ * cache_flight_begin - 캐시 미스난 uri를 원 서버에서 가져오기 전에 부른다.
+ *     아무도 안 가져오고 있으면 새 flight를 만들고 *leadp = 1 (leader가 buf를 채우고 꼭 cache_flight_end).
+ *     누가 가져오는 중이면 그 flight에 붙고 *leadp = 0 (cache_flight_wait으로 따라가고 cache_flight_leave)
+ */
+flight *cache_flight_begin(char *uri, int *leadp) {
+  uint64_t hash = cache_hash(uri);
+  cache_shard *sh = shard_of(hash);
+  flight *f;
+
+  pthread_mutex_lock(&sh->flight_m);
+  for (f = sh->flights; f && (f->hash != hash || strcmp(f->uri, uri)); f = f->next)
+    ;
+  if (f) {
+    f->waiters++;
+    STAT_INC(coalesced);
+    *leadp = 0;
+  }
+  else {
+    f = Malloc(sizeof(flight) + strlen(uri) + 1);
+    f->hash = hash;
+    f->state = FLIGHT_WAIT;
+    f->filled = f->hdr_len = 0;
+    f->framed = 0;
+    f->waiters = 0;
+    f->ended = 0;
+    f->touched = time(NULL);
+    pthread_cond_init(&f->cv, NULL);
+    f->buf = Malloc(MAX_OBJECT_SIZE);
+    strcpy(f->uri, uri);
+    f->next = sh->flights;
+    sh->flights = f;
+    *leadp = 1;
+  }
+  pthread_mutex_unlock(&sh->flight_m);
+  return f;
+}
+
+static void flight_free(flight *f) {
+  pthread_cond_destroy(&f->cv);
+  Free(f->buf);
+  Free(f);
+}
+
+/*
+ * cache_flight_wait - 붙은 쪽 : sent 바이트까지 보냈을 때 더 보낼 게 생길 때까지 기다린다.
+ *     리턴값 : 상태. *filledp에 그때 채워진 바이트 수.
+ *     FLIGHT_STREAM이면 filled > sent, FLIGHT_DONE이면 filled까지가 전부, FLIGHT_FAIL이면 포기.
+ *     filled가 안 올라가도 leader가 원 서버에서 받고 있으면 (touched) 기다린다 : 디스크로 가는 큰 객체나
+ *     uring 중계는 끝날 때까지 filled를 안 올린다. leader가 FLIGHT_WAIT_SECS 동안 아무것도 못 받았으면
+ *     (원 서버가 멈춤) FLIGHT_FAIL
+ */
+int cache_flight_wait(flight *f, size_t sent, size_t *filledp) {
+  cache_shard *sh = shard_of(f->hash);
+  struct timespec deadline = { 0, 0 };
+  int state;
+
+  pthread_mutex_lock(&sh->flight_m);
+  while (f->state == FLIGHT_WAIT || (f->state == FLIGHT_STREAM && f->filled <= sent)) {
+    deadline.tv_sec = __atomic_load_n(&f->touched, __ATOMIC_RELAXED) + FLIGHT_WAIT_SECS;
+    if (time(NULL) >= deadline.tv_sec) {
+      break;
+    }
+    pthread_cond_timedwait(&f->cv, &sh->flight_m, &deadline);
+  }
+  state = f->state;
+  if (state == FLIGHT_WAIT || (state == FLIGHT_STREAM && f->filled <= sent)) {
+    state = FLIGHT_FAIL;
+  }
+  *filledp = f->filled;
+  pthread_mutex_unlock(&sh->flight_m);
+  return state;
+}
+
+/* cache_flight_fill - leader : buf를 filled까지 채웠고 상태는 state. 붙은 쪽을 깨운다
+   (hdr_len, framed는 FLIGHT_STREAM, FLIGHT_DONE으로 바꾸기 전에 정해 둔다) */
+void cache_flight_fill(flight *f, size_t filled, int state) {
+  cache_shard *sh = shard_of(f->hash);
+
+  pthread_mutex_lock(&sh->flight_m);
+  f->filled = filled;
+  f->state = state;
+  f->touched = time(NULL);
+  if (f->waiters > 0) {
+    pthread_cond_broadcast(&f->cv);
+  }
+  pthread_mutex_unlock(&sh->flight_m);
+}
+
+/* cache_flight_touch - leader : 원 서버에서 뭔가 받았다 (붙은 쪽의 대기 기한이 늘어남).
+   조각마다 불리니까 초가 바뀔 때만 쓴다 */
+void cache_flight_touch(flight *f) {
+  time_t now = time(NULL);
+
+  if (__atomic_load_n(&f->touched, __ATOMIC_RELAXED) != now) {
+    __atomic_store_n(&f->touched, now, __ATOMIC_RELAXED);
+  }
+}
+
+/* cache_flight_end - leader가 손을 뗌. 목록에서 빼서 새 요청은 캐시를 보게 하고,
+   다 채우지 못했으면 붙은 쪽에 실패를 알린다 */
+void cache_flight_end(flight *f) {
+  cache_shard *sh = shard_of(f->hash);
+  flight **pp;
+
+  pthread_mutex_lock(&sh->flight_m);
+  for (pp = &sh->flights; *pp != f; pp = &(*pp)->next)
+    ;
+  *pp = f->next;
+  f->ended = 1;
+  if (f->state != FLIGHT_DONE) {
+    f->state = FLIGHT_FAIL;
+    pthread_cond_broadcast(&f->cv);
+  }
+  if (f->waiters == 0) {
+    flight_free(f);
+  }
+  pthread_mutex_unlock(&sh->flight_m);
+}
+
+/* cache_flight_leave - 붙은 쪽이 손을 뗌. leader도 끝났으면 마지막이 free */
+void cache_flight_leave(flight *f) {
+  cache_shard *sh = shard_of(f->hash);
+
+  pthread_mutex_lock(&sh->flight_m);
+  if (--f->waiters == 0 && f->ended) {
+    flight_free(f);
+  }
+  pthread_mutex_unlock(&sh->flight_m);
+}
+
+/*
+ * cache_get - uri 항목을 고정(pin)해서 돌려준다. 없으면 NULL.
+ *     받은 쪽은 락 없이 data를 읽고, 다 쓰면 cache_put. 그 사이에 교체돼도 free되지 않는다
+ */
+cache_entry *cache_get(char *uri) {
+  uint64_t hash = cache_hash(uri);    // 해시는 락 밖에서
+  cache_shard *sh = shard_of(hash);
+
+  // 적중이 리스트를 안 고치는 정책이면 적중 쓰레드끼리는 서로 안 막는다
+  if (g_cache.pol->shared_hit) {
+    pthread_rwlock_rdlock(&sh->cache_m);
+  }
+  else {
+    pthread_rwlock_wrlock(&sh->cache_m);
+  }
+  cache_entry *e = hindex_find(&sh->index, hash, uri);
+  if (g_cache.pol->access) {
+    g_cache.pol->access(sh->ps, hash);
+  }
+  if (e) {
+    g_cache.pol->hit(sh->ps, e);
+    __atomic_add_fetch(&e->refcnt, 1, __ATOMIC_RELAXED);
+  }
+  // I/O는 속도가 느려짐으로 unlock
+  pthread_rwlock_unlock(&sh->cache_m);
+  return e;
+}
+
+/* 항목이 차지하는 바이트 (헤더 + data + uri) */
+static size_t entry_bytes(cache_entry *e) {
+  return e->uri + strlen(e->uri) + 1 - (char *)e;
+}
+
+/* cache_get으로 잡은 참조를 놓는다. 캐시에서 이미 빠진 항목이면 마지막 쪽이 슬랩에 돌려줌 */
+void cache_put(cache_entry *e) {
+  if (__atomic_sub_fetch(&e->refcnt, 1, __ATOMIC_ACQ_REL) == 0) {
+    slab_free(e, entry_bytes(e));
+  }
+}
+
+/* 항목을 샤드 인덱스에서 빼고 캐시의 참조를 놓는다. 그 샤드 락 잡고 호출.
+   evicted면 자리가 없어서 내보내는 것 (정책이 유령으로 기억할 수 있음) */
+static void cache_evict(cache_shard *sh, cache_entry *e, int evicted) {
+  hindex_remove(&sh->index, e->hash, e->uri);
+  g_cache.pol->remove(sh->ps, e, evicted);
+  sh->current_size -= e->size;
+  STAT_INC(cache_evictions);
+  cache_put(e);
+}
+
+/* 페이지 비우기 : 슬롯 it가 아직 어느 샤드에 들어 있으면 내보낸다. sh 락 잡고 호출.
+   다른 샤드 락은 trylock으로만 잡는다 (기다리면 서로의 페이지를 비우려는 두 샤드가 교착).
+   채우는 중(hash 0)이거나 이미 빠지고 잡혀만 있는 항목, 락을 못 잡은 샤드의 항목은 건너뜀 */
+static void cache_reclaim(cache_shard *sh, cache_entry *it) {
+  uint64_t hash = __atomic_load_n(&it->hash, __ATOMIC_RELAXED);
+  cache_shard *owner;
+
+  if (hash <= HASH_DELETED) {
+    return;
+  }
+  owner = shard_of(hash);
+  if (owner != sh && pthread_rwlock_trywrlock(&owner->cache_m) != 0) {
+    return;
+  }
+  // 락을 잡고 나서 포인터로 확인. 그 사이에 다른 항목이 됐으면 인덱스에 없다
+  if (hindex_has(&owner->index, hash, it)) {
+    cache_evict(owner, it, 1);
+  }
+  if (owner != sh) {
+    pthread_rwlock_unlock(&owner->cache_m);
+  }
+}
+
+/*
+ * cache_alloc - 샤드 sh에 size 바이트 객체를 담을 need 바이트 슬롯을 받는다. sh 락 잡고 호출.
+ *     hash는 들어올 항목의 해시 (정책이 참고). 샤드 예산을 넘거나 그 크기 클래스에 자리가 없으면
+ *     정책이 고른 희생자부터 내보낸다. 클래스가 다른 항목은 하나 내보내 봐야 소용이 없으니, 그 항목이
+ *     든 페이지를 통째로 비워 빈 페이지로 돌린다 (크기 분포가 바뀌면 페이지가 이렇게 클래스 사이를
+ *     옮겨 다님). 샤드가 빌 때까지 안 되면 NULL
+ */
+static cache_entry *cache_alloc(cache_shard *sh, size_t need, size_t size, uint64_t hash) {
+  static __thread void *items[SLAB_PAGE / SLAB_MIN];
+  cache_entry *e;
+
+  while (1) {
+    if (sh->current_size + size <= sh->budget && (e = slab_alloc(need)) != NULL) {
+      sh->current_size += size;     // 채우는 동안에도 예산에 잡아 둔다
+      return e;
+    }
+    cache_entry *victim = g_cache.pol->victim(sh->ps, hash);
+    if (!victim) {
+      return NULL;      // 남은 슬롯은 다른 샤드 것이거나 다른 쓰레드가 아직 잡고 있는 항목들
+    }
+    if (sh->current_size + size > sh->budget || slab_same_class(victim, need)) {
+      cache_evict(sh, victim, 1);
+      continue;
+    }
+    // victim은 이 샤드 항목이라 늘 여기서 빠진다 (그래서 반복이 끝남)
+    int n = slab_page_items(victim, items);
+    for (int i = 0; i < n; i++) {
+      cache_reclaim(sh, items[i]);
+    }
+  }
+}
+
+/* 슬롯은 락 안에서 받고, 채우는 건 락 밖에서, 넣는 건 다시 락 잡고 cache_insert (uri는 data 뒤에) */
+void cache_store(char *uri, char *chebuf, size_t total_size, size_t hdr_len, time_t expires, long grace) {
+  size_t urilen = strlen(uri);
+  uint64_t hash = cache_hash(uri);
+  cache_shard *sh = shard_of(hash);
+  cache_entry *e;
+
+  if (total_size > sh->budget) {
+    return;
+  }
+  pthread_rwlock_wrlock(&sh->cache_m);
+  e = cache_alloc(sh, sizeof(cache_entry) + total_size + urilen + 1, total_size, hash);
+  if (e) {
+    // 채우는 동안 cache_reclaim이 캐시 항목으로 보지 않게 (다른 샤드가 락 없이 읽음)
+    __atomic_store_n(&e->hash, HASH_EMPTY, __ATOMIC_RELAXED);
+  }
+  pthread_rwlock_unlock(&sh->cache_m);
+  if (!e) {
+    return;
+  }
+
+  e->refcnt = 1;          // 캐시 자신의 참조
+  e->size = total_size;
+  e->hdr_len = hdr_len;
+  e->expires = expires;
+  e->grace = grace;
+  e->refreshing = 0;
+  e->uri = e->data + total_size;
+  memcpy(e->data, chebuf, total_size);
+  memcpy(e->uri, uri, urilen + 1);
+
+  pthread_rwlock_wrlock(&sh->cache_m);
+  __atomic_store_n(&e->hash, hash, __ATOMIC_RELAXED);
+  cache_insert(sh, e);
+  pthread_rwlock_unlock(&sh->cache_m);
+}
+
+/* cache_remove - uri 항목을 뺀다 (새 버전이 디스크 캐시로 갔을 때). 없으면 아무것도 안 함 */
+void cache_remove(char *uri) {
+  uint64_t hash = cache_hash(uri);
+  cache_shard *sh = shard_of(hash);
+  cache_entry *e;
+
+  pthread_rwlock_wrlock(&sh->cache_m);
+  if ((e = hindex_find(&sh->index, hash, uri)) != NULL) {
+    cache_evict(sh, e, 0);
+  }
+  pthread_rwlock_unlock(&sh->cache_m);
+}
+
+/* cache_negative - 원 서버 실패로 만든 에러 응답 resp를 key로 ttl초 캐시한다 (-N, 0이면 안 함).
+   원 서버 응답 그대로처럼 hdr_len 0 (에러 응답은 Connection: close를 달고 있어서 적중하면 연결을 닫는다).
+   key에 진짜 객체(2xx)가 있으면 만료됐어도 502로 덮지 않는다 (원 서버가 돌아오면 재검증할 사본).
+   만료된 음성 항목은 새 기한으로 바꿔 넣는다 */
+void cache_negative(char *key, char *resp, size_t n, long ttl) {
+  cache_entry *old;
+  int keep = 0;
+
+  if (ttl <= 0) {
+    return;
+  }
+  if ((old = cache_get(key)) != NULL) {
+    keep = fresh_status(old->data, old->size) / 100 == 2;
+    cache_put(old);
+  }
+  if (!keep) {
+    cache_store(key, resp, n, 0, time(NULL) + ttl, 0);
+    STAT_INC(negative_stores);
+  }
+}
+
+/* cache_refresh - 재검증(304)으로 항목이 다시 신선해짐. 잡고(cache_get) 있는 항목에만.
+   적중 경로가 락 없이 읽으니까 atomic으로 */
+void cache_refresh(cache_entry *e, time_t expires) {
+  __atomic_store_n(&e->expires, expires, __ATOMIC_RELAXED);
+}
+
+/*
+ * cache_walk - 캐시에 든 항목마다 fn(e, arg) (스냅샷, snap.c). 샤드마다 읽기 락 안에서 항목을 잡아
+ *     두기만 하고 fn은 락 밖에서 부른다. fn이 음수를 돌려주면 멈춘다. 리턴값 : 0, fn이 멈췄으면 그 값
+ */
+int cache_walk(int (*fn)(cache_entry *e, void *arg), void *arg) {
+  int rc = 0;
+
+  for (int i = 0; i < g_cache.nshards && rc == 0; i++) {
+    cache_shard *sh = &g_cache.shards[i];
+    htable *tabs[2] = { &sh->index.cur, &sh->index.old };
+    cache_entry **items;
+    size_t n = 0;
+
+    pthread_rwlock_rdlock(&sh->cache_m);
+    items = Malloc((tabs[0]->live + tabs[1]->live + 1) * sizeof(cache_entry *));
+    for (int t = 0; t < 2; t++) {
+      for (size_t j = 0; tabs[t]->slots && j < tabs[t]->cap; j++) {
+        // 옛 표에서 옮긴 슬롯은 tombstone이라 한 항목은 한 번만 나온다
+        if (tabs[t]->slots[j].hash > HASH_DELETED) {
+          items[n] = tabs[t]->slots[j].blk;
+          __atomic_add_fetch(&items[n]->refcnt, 1, __ATOMIC_RELAXED);
+          n++;
+        }
+      }
+    }
+    pthread_rwlock_unlock(&sh->cache_m);
+    for (size_t j = 0; j < n; j++) {
+      if (rc == 0 && (rc = fn(items[j], arg)) > 0) {
+        rc = 0;
+      }
+      cache_put(items[j]);
+    }
+    Free(items);
+  }
+  return rc;
+}
+
+static void cache_insert(cache_shard *sh, cache_entry *e) {
+  cache_entry *old = hindex_find(&sh->index, e->hash, e->uri);
+
+  // 같은 uri를 두 쓰레드가 동시에 미스로 받아 온 경우. 있던 항목을 빼고 새 걸로
+  if (old) {
+    cache_evict(sh, old, 0);
+  }
+  // 캐시 정보 업데이트 (current_size는 cache_alloc에서 이미 더했음)
+  g_cache.pol->insert(sh->ps, e);
+  hindex_insert(&sh->index, e->hash, e);
+}
@@ -0,0 +1,65 @@
+/*
+ * cache.h - 프록시 웹 객체 캐시 (uri -> 응답 바이트)
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "csapp.h"
+#include <stdint.h>
+
+// 캐시 항목. cache_get으로 잡고 있는 동안은 내용이 바뀌거나 free되지 않는다
+typedef struct cache_entry {
+  uint64_t hash;   // cache_hash(uri)
+  int refcnt;      // 캐시 자신의 참조(캐시에 들어 있는 동안 1) + cache_get 한 쪽 수
+  struct cache_entry *prev, *next;   // 교체 정책의 리스트 (캐시 락 안에서만, policy.c)
+  unsigned char q;     // 정책 안에서 들어 있는 리스트
+  unsigned char freq;  // CLOCK 참조 비트, S3-FIFO 빈도 (읽기 락 적중이 atomic으로 올림)
+  size_t size;     // 실제 데이터의 사이즈
+  size_t hdr_len;  // data 앞쪽 응답 헤더 길이 (hop-by-hop 헤더는 뺐음). 0이면 원 서버 응답 그대로
+  time_t expires;  // 이 시각부터는 재검증해야 씀 (fresh.c). cache_refresh로만 바뀜
+  long grace;      // 만료 뒤 이만큼은 만료된 채로 보내고 백그라운드에서 재검증 (초)
+  int refreshing;  // 백그라운드 재검증이 돌고 있음 (atomic)
+  char *uri;       // data 뒤에 같이 할당
+  char data[];     // 캐시에 들어있는 데이터
+} cache_entry;
+
+// 원 서버에서 가져오는 중인 응답 (single-flight). leader가 buf를 채우고 같은 uri의 다른 미스는 붙어서 따라 보낸다
+#define FLIGHT_WAIT    0  // 응답을 캐시할 수 있을지 아직 모름. 붙은 쪽은 다 받을 때까지 기다림
+#define FLIGHT_STREAM  1  // MAX_OBJECT_SIZE 안에 들어가는 길이가 정해진 응답. filled까지 보내도 됨
+#define FLIGHT_DONE    2  // buf에 응답 전부
+#define FLIGHT_FAIL    3  // 못 채움 (너무 큼, 에러). 아직 아무것도 안 보낸 쪽은 각자 가져온다
+
+typedef struct flight {
+  uint64_t hash;
+  int state;
+  size_t filled;          // buf 앞에서부터 채운 바이트. 여기까지는 다시 안 바뀐다
+  size_t hdr_len;         // cache_entry와 같음 (0이면 원 서버 응답 그대로)
+  int framed;             // 응답 끝을 길이로 알 수 있음. 아니면 보내고 연결을 닫는다
+  int waiters;            // 붙어 있는 쓰레드 수
+  int ended;              // leader가 손을 뗌
+  time_t touched;         // leader가 원 서버에서 마지막으로 뭔가 받은 때 (cache_flight_touch)
+  pthread_cond_t cv;      // filled, state가 바뀌면 broadcast
+  struct flight *next;
+  char *buf;              // MAX_OBJECT_SIZE
+  char uri[];
+} flight;
+
+void cache_init(size_t budget, int policy, int nshards);
+cache_entry *cache_get(char *uri);
+void cache_put(cache_entry *e);
+void cache_store(char *uri, char *chebuf, size_t total_size, size_t hdr_len, time_t expires, long grace);
+void cache_refresh(cache_entry *e, time_t expires);
+void cache_remove(char *uri);
+void cache_negative(char *key, char *resp, size_t n, long ttl);
+int cache_walk(int (*fn)(cache_entry *e, void *arg), void *arg);
+
+flight *cache_flight_begin(char *uri, int *leadp);
+int cache_flight_wait(flight *f, size_t sent, size_t *filledp);
+void cache_flight_fill(flight *f, size_t filled, int state);
+void cache_flight_touch(flight *f);
+void cache_flight_end(flight *f);
+void cache_flight_leave(flight *f);
+
+uint64_t cache_hash(const char *key);
+
+#endif /* __CACHE_H__ */
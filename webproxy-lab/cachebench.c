@@ -0,0 +1,115 @@
+/*
+ * cachebench.c - 캐시 적중 경로 벤치마크 (네트워크 없이 cache.c만)
+ *
+ * 객체 keys개를 캐시에 넣어 두고, 쓰레드 1, 2, 4, ... threads개가 secs초 동안
+ * 무작위 키로 cache_get -> 본문 한 바이트 읽기 -> cache_put을 반복한다.
+ * 쓰레드 수마다 초당 적중 수를 출력해서 샤드 수(-s)나 정책(-p)에 따라 락 경합이
+ * 얼마나 되는지 본다.
+ *
+ * usage: cachebench [-t threads] [-d secs] [-k keys] [-s shards] [-p policy]
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "cache.h"
+#include "policy.h"
+
+#define OBJ_SIZE 512       // 넣어 둘 객체 크기
+
+proxy_stats g_stats;       // cache.c가 세는 카운터 (여기서는 안 봄)
+
+static int g_keys = 1000;
+static int g_secs = 2;
+static char **g_uris;
+static volatile int g_stop;
+
+typedef struct {
+  long hits;
+  unsigned seed;
+  char pad[64];            // 쓰레드끼리 캐시 라인을 나눠 쓰지 않게
+} worker_t;
+
+static void *worker(void *vargp) {
+  worker_t *w = vargp;
+  long sum = 0;
+
+  while (!g_stop) {
+    cache_entry *e = cache_get(g_uris[rand_r(&w->seed) % g_keys]);
+    if (e) {
+      sum += e->data[0];
+      cache_put(e);
+      w->hits++;
+    }
+  }
+  return (void *)sum;
+}
+
+static double run(int nthreads) {
+  pthread_t *tids = Calloc(nthreads, sizeof(pthread_t));
+  worker_t *ws = Calloc(nthreads, sizeof(worker_t));
+  long total = 0;
+
+  g_stop = 0;
+  for (int i = 0; i < nthreads; i++) {
+    ws[i].seed = i + 1;
+    Pthread_create(&tids[i], NULL, worker, &ws[i]);
+  }
+  sleep(g_secs);
+  g_stop = 1;
+  for (int i = 0; i < nthreads; i++) {
+    Pthread_join(tids[i], NULL);
+    total += ws[i].hits;
+  }
+  Free(tids);
+  Free(ws);
+  return (double)total / g_secs;
+}
+
+int main(int argc, char **argv) {
+  int threads = 8, shards = DEFAULT_CACHE_SHARDS, policy = POLICY_LRU, opt;
+  char body[OBJ_SIZE];
+
+  while ((opt = getopt(argc, argv, "t:d:k:s:p:")) != -1) {
+    switch (opt) {
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'd':
+      g_secs = atoi(optarg);
+      break;
+    case 'k':
+      g_keys = atoi(optarg);
+      break;
+    case 's':
+      shards = atoi(optarg);
+      break;
+    case 'p':
+      policy = policy_find(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc || threads <= 0 || g_secs <= 0 || g_keys <= 0 || shards <= 0 || policy < 0) {
+    goto usage;
+  }
+
+  // 전부 들어가도록 예산을 넉넉하게 잡고 채운다
+  cache_init((size_t)g_keys * (OBJ_SIZE + 256) * 2 + (size_t)shards * MAX_OBJECT_SIZE, policy, shards);
+  memset(body, 'x', sizeof(body));
+  g_uris = Calloc(g_keys, sizeof(char *));
+  for (int i = 0; i < g_keys; i++) {
+    g_uris[i] = Malloc(MAXLINE);
+    snprintf(g_uris[i], MAXLINE, "http://origin.example:8080/object/%d", i);
+    cache_store(g_uris[i], body, sizeof(body), 0, time(NULL) + 3600, 0);
+  }
+
+  printf("keys=%d shards=%d policy=%s secs=%d\n", g_keys, shards, policy_get(policy)->name, g_secs);
+  for (int n = 1; n <= threads; n *= 2) {
+    printf("threads=%-3d hits/s=%.0f\n", n, run(n));
+  }
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-t threads] [-d secs] [-k keys] [-s shards] [-p policy]\n", argv[0]);
+  exit(1);
+}
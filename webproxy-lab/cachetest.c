@@ -0,0 +1,541 @@
+/*
+ * cachetest.c - 캐시 쪽 정확성 테스트 (네트워크 없이). make test로 돌린다
+ *
+ * 테스트마다 캐시를 새로 만들고 (cache_init) 결과를 CHECK로 확인한다.
+ * 실패한 CHECK는 파일:줄과 함께 찍고, 하나라도 실패하면 종료 코드 1
+ *  - 슬랩 : 크기가 섞인 객체와 큰 객체가 예산 안에서 다 남는지
+ *  - 캐시 : 바이트 예산, 내보내는 순서, 정책별 희생자 순서 (policy.c를 직접),
+ *           tinylfu의 빈도 비교 입장, arc 유령 적중에 따른 목표 p 이동
+ *  - fresh.c : 수명과 유예 계산, Vary와 인증 요청의 저장 거절, 음성 응답의 -N 상한, 응답 끝 판정
+ *  - 스냅샷 : 저장하고 다시 올리기, 깨진 파일 거부 (snap.c)
+ *  - 음성 캐시 : cache_negative의 기한, 만료 뒤 다시 걸기, 진짜 객체는 안 덮음
+ *
+ * usage: cachetest
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "cache.h"
+#include "slab.h"
+#include "policy.h"
+#include "fresh.h"
+#include "snap.h"
+
+proxy_stats g_stats;       // cache.c가 세는 카운터
+
+static int g_failed;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      g_failed++; \
+    } \
+  } while (0)
+
+static char g_body[MAX_OBJECT_SIZE];
+
+static char *obj_uri(char *buf, int i) {
+  snprintf(buf, MAXLINE, "http://origin.example/object/%d", i);
+  return buf;
+}
+
+static void put_obj(int i, size_t size) {
+  char uri[MAXLINE];
+
+  cache_store(obj_uri(uri, i), g_body, size, 0, time(NULL) + 3600, 0);
+}
+
+static int resident(int i) {
+  char uri[MAXLINE];
+  cache_entry *e;
+
+  if ((e = cache_get(obj_uri(uri, i))) == NULL) {
+    return 0;
+  }
+  cache_put(e);
+  return 1;
+}
+
+/* 크기가 제각각인 객체 (1 KB부터 1.3배씩 12개, 합 74 KB)가 1 MB 캐시에 전부 남는다.
+   크기 클래스마다 페이지를 하나씩 차지해도 자리가 모자라면 안 됨 */
+static void test_mixed_sizes(void) {
+  double size = 1024;
+  int n = 0;
+
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, DEFAULT_CACHE_SHARDS);
+  memset(&g_stats, 0, sizeof(g_stats));
+  for (int i = 0; i < 12; i++, size *= 1.3) {
+    put_obj(i, (size_t)size);
+  }
+  for (int i = 0; i < 12; i++) {
+    n += resident(i);
+  }
+  CHECK(n == 12);
+  CHECK(g_stats.cache_evictions == 0);
+}
+
+/* MAX_OBJECT_SIZE 언저리의 큰 객체 (페이지 여러 장)와 작은 객체가 섞여도 다 들어가고,
+   큰 객체를 내보내면 그 페이지를 작은 객체가 다시 쓴다 */
+static void test_large_objects(void) {
+  int n = 0;
+
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, 1);
+  memset(&g_stats, 0, sizeof(g_stats));
+  for (int i = 0; i < 4; i++) {
+    put_obj(i, MAX_OBJECT_SIZE - 100);
+  }
+  for (int i = 4; i < 104; i++) {
+    put_obj(i, 3000);
+  }
+  for (int i = 0; i < 104; i++) {
+    n += resident(i);
+  }
+  CHECK(n == 104);
+  CHECK(slab_stats.large == 4);
+
+  // 작은 객체로 예산을 넘기면 큰 객체부터 (LRU) 빠진다
+  for (int i = 104; i < 400; i++) {
+    put_obj(i, 3000);
+  }
+  CHECK(!resident(0));
+  CHECK(resident(399));
+  CHECK(slab_stats.large == 0);
+}
+
+/* cache_walk 콜백 : 들어 있는 항목 수와 바이트 합 */
+static int count_entry(cache_entry *e, void *arg) {
+  long *acc = arg;
+
+  acc[0]++;
+  acc[1] += e->size;
+  return 0;
+}
+
+/* 예산을 넘게 넣으면 바이트 합이 예산 안에 머물고, LRU라 오래된 것부터 빠진다.
+   중간에 적중한 항목은 살아남는다. 1000바이트 객체는 페이지(8장)당 11개라 88개까지 */
+static void test_byte_budget(void) {
+  size_t budget = 8 * SLAB_PAGE;
+  long acc[2] = { 0, 0 };
+
+  cache_init(budget, POLICY_LRU, 1);
+  memset(&g_stats, 0, sizeof(g_stats));
+  for (int i = 0; i < 60; i++) {
+    put_obj(i, 1000);
+  }
+  CHECK(g_stats.cache_evictions == 0);
+  CHECK(resident(0));       // 적중 -> 제일 최근
+  for (int i = 60; i < 120; i++) {
+    put_obj(i, 1000);
+  }
+  cache_walk(count_entry, acc);
+  CHECK(acc[1] <= (long)budget);
+  CHECK(acc[0] + g_stats.cache_evictions == 120);
+  CHECK(g_stats.cache_evictions > 0);
+  CHECK(resident(0));
+  CHECK(!resident(1));
+  CHECK(resident(119));
+
+  // 예산보다 큰 객체는 아예 안 들어가고 있던 것도 안 건드린다
+  cache_init(2 * SLAB_PAGE, POLICY_LRU, 1);
+  put_obj(0, 1000);
+  put_obj(1, 3 * SLAB_PAGE);
+  CHECK(resident(0));
+  CHECK(!resident(1));
+}
+
+/* 해시 인덱스를 늘리는 중 (옛 표에서 몇 슬롯씩 옮기는 중)에 빼거나 내보낸 항목은 다시 안 보이고,
+   한 항목을 두 번 내보내지도 않는다. 샤드 하나라 처음 슬롯 16개에서 몇 번이고 늘어난다 */
+static void test_index_resize(void) {
+  char uri[MAXLINE];
+  long acc[2] = { 0, 0 };
+  int n = 0, ok = 1;
+
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, 1);
+  for (int i = 0; i < 200; i++) {
+    put_obj(i, 100);
+    if (i >= 20 && i % 2 == 0) {
+      cache_remove(obj_uri(uri, i - 20));
+      ok &= !resident(i - 20);
+    }
+  }
+  for (int i = 0; i < 200; i++) {
+    ok &= resident(i) == (i % 2 || i > 178);
+  }
+  CHECK(ok);
+  cache_walk(count_entry, acc);
+  CHECK(acc[0] == 110 && acc[1] == 110 * 100);
+
+  // 예산이 작아서 넣는 내내 내보냄. 남은 것 + 내보낸 것 = 넣은 것
+  cache_init(4 * SLAB_PAGE, POLICY_LRU, 1);
+  memset(&g_stats, 0, sizeof(g_stats));
+  for (int i = 0; i < 2000; i++) {
+    put_obj(i, 100);
+  }
+  for (int i = 0; i < 2000; i++) {
+    n += resident(i);
+  }
+  acc[0] = acc[1] = 0;
+  cache_walk(count_entry, acc);
+  CHECK(g_stats.cache_evictions > 0);
+  CHECK(n == acc[0] && n + g_stats.cache_evictions == 2000);
+  CHECK(acc[1] <= 4 * SLAB_PAGE);
+}
+
+/* 정책 상태를 캐시 없이 직접 만들어서 희생자 순서를 본다. 항목은 크기 100 */
+static cache_entry *fake_entry(uint64_t hash) {
+  cache_entry *e = Calloc(1, sizeof(cache_entry));
+
+  e->hash = hash;
+  e->size = 100;
+  return e;
+}
+
+static void test_policy_order(void) {
+  const cache_policy *p;
+  policy_state *ps;
+  cache_entry *a, *b, *c, *b2;
+
+  // lru : 적중한 a는 뒤로 밀리고 b, c, a 순서
+  p = policy_get(POLICY_LRU);
+  ps = p->init(1000);
+  p->insert(ps, a = fake_entry(11));
+  p->insert(ps, b = fake_entry(12));
+  p->insert(ps, c = fake_entry(13));
+  p->hit(ps, a);
+  CHECK(p->victim(ps, 0) == b);
+  p->remove(ps, b, 1);
+  CHECK(p->victim(ps, 0) == c);
+  p->remove(ps, c, 1);
+  CHECK(p->victim(ps, 0) == a);
+  p->remove(ps, a, 1);
+  CHECK(p->victim(ps, 0) == NULL);
+
+  // clock : 참조 비트가 선 a는 한 번 봐주고 (비트를 지우고 머리로) b, c, a 순서
+  p = policy_get(POLICY_CLOCK);
+  ps = p->init(1000);
+  p->insert(ps, a);
+  p->insert(ps, b);
+  p->insert(ps, c);
+  p->hit(ps, a);
+  CHECK(p->victim(ps, 0) == b);
+  p->remove(ps, b, 1);
+  CHECK(p->victim(ps, 0) == c);
+  p->remove(ps, c, 1);
+  CHECK(p->victim(ps, 0) == a);
+  p->remove(ps, a, 1);
+
+  // s3fifo : 작은 FIFO(예산의 10%)가 넘치면 읽힌 a는 본 FIFO로 올라가고 안 읽힌 b가 나간다.
+  // 내보낸 b는 유령으로 남아서 다시 들어오면 바로 본 FIFO로
+  p = policy_get(POLICY_S3FIFO);
+  ps = p->init(1000);
+  p->insert(ps, a);
+  p->insert(ps, b);
+  p->insert(ps, c);
+  p->hit(ps, a);
+  CHECK(p->victim(ps, 0) == b);
+  CHECK(a->q != b->q && b->q == c->q);
+  p->remove(ps, b, 1);
+  p->insert(ps, b2 = fake_entry(12));
+  CHECK(b2->q == a->q);
+  Free(a);
+  Free(b);
+  Free(c);
+  Free(b2);
+}
+
+/* tinylfu : 창(예산의 1%)에서 밀려난 후보는 본 영역에 자리가 있으면 그냥 probation으로.
+   본 영역이 차 있으면 sketch로 잰 빈도가 probation 희생자보다 높아야 들어가고, 아니면 후보가 나간다 */
+static void test_tinylfu(void) {
+  const cache_policy *p = policy_get(POLICY_TINYLFU);
+  policy_state *ps = p->init(1000);
+  cache_entry *m[9], *x;
+
+  // 본 영역 (990바이트)에 100바이트 9개
+  for (int i = 0; i < 9; i++) {
+    p->access(ps, 20 + i);
+    p->insert(ps, m[i] = fake_entry(20 + i));
+  }
+  CHECK(p->victim(ps, 0) == m[0]);
+  for (int i = 1; i < 9; i++) {
+    CHECK(m[i]->q == m[0]->q);
+  }
+  for (int i = 0; i < 5; i++) {
+    p->access(ps, m[0]->hash);
+  }
+
+  // 한 번 본 후보 x < 여섯 번 본 희생자 m[0] : x가 나가고 창에 그대로
+  p->access(ps, 30);
+  p->insert(ps, x = fake_entry(30));
+  CHECK(p->victim(ps, 30) == x);
+  CHECK(x->q != m[0]->q);
+
+  // x가 더 자주 보이면 probation으로 들어가고 희생자는 m[0]
+  for (int i = 0; i < 10; i++) {
+    p->access(ps, 30);
+  }
+  CHECK(p->victim(ps, 30) == m[0]);
+  CHECK(x->q == m[0]->q);
+
+  // probation에서 다시 읽히면 protected로 올라가서 희생자 후보에서 빠진다
+  p->remove(ps, m[0], 1);
+  CHECK(p->victim(ps, 0) == m[1]);
+  p->hit(ps, m[1]);
+  CHECK(m[1]->q != m[2]->q);
+  CHECK(p->victim(ps, 0) == m[2]);
+  for (int i = 0; i < 9; i++) {
+    Free(m[i]);
+  }
+  Free(x);
+}
+
+/* arc : T1 유령(B1)에 적중하면 T1 목표 p가 커져서 다음 희생자가 T2에서,
+   T2 유령(B2)에 적중하면 p가 줄어서 다시 T1에서 나온다 */
+static void test_arc(void) {
+  const cache_policy *p = policy_get(POLICY_ARC);
+  policy_state *ps = p->init(1000);
+  cache_entry *a, *b, *c, *a2, *b2;
+
+  p->insert(ps, a = fake_entry(11));
+  p->insert(ps, b = fake_entry(12));
+  p->insert(ps, c = fake_entry(13));
+  p->hit(ps, a);                          // T1 = c b, T2 = a
+  CHECK(a->q != b->q && b->q == c->q);
+  CHECK(p->victim(ps, 0) == b);           // p = 0 이라 T1부터
+  p->remove(ps, b, 1);                    // b -> B1
+
+  p->insert(ps, b2 = fake_entry(12));     // B1 적중 : p = 100, b는 T2로
+  CHECK(b2->q == a->q);
+  CHECK(p->victim(ps, 0) == a);           // |T1| = p 라 이제 T2의 꼬리
+  p->remove(ps, a, 1);                    // a -> B2
+
+  p->insert(ps, a2 = fake_entry(11));     // B2 적중 : p = 0
+  CHECK(a2->q == b2->q);
+  CHECK(p->victim(ps, 0) == c);           // 다시 T1부터
+  Free(a);
+  Free(b);
+  Free(c);
+  Free(a2);
+  Free(b2);
+}
+
+/* t를 HTTP 날짜로 */
+static char *http_date(char *buf, time_t t) {
+  struct tm tm;
+
+  strftime(buf, 64, "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+  return buf;
+}
+
+/* 헤더 줄들(hdrs)로 응답 헤더를 만든다 */
+static size_t make_resp(char *buf, int status, char *hdrs) {
+  return sprintf(buf, "HTTP/1.1 %d X\r\n%s\r\n", status, hdrs);
+}
+
+static void test_freshness(void) {
+  char resp[MAXLINE], hdrs[MAXLINE], d1[64], d2[64];
+  time_t now = time(NULL), exp;
+  size_t n;
+
+  fresh_init(300, 10, 5);
+
+  n = make_resp(resp, 200, "Cache-Control: max-age=60\r\n");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_EXPLICIT && exp == now + 60);
+  n = make_resp(resp, 200, "Cache-Control: max-age=60, s-maxage=30\r\n");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_EXPLICIT && exp == now + 30);
+  n = make_resp(resp, 200, "Cache-Control: max-age=60\r\nAge: 10\r\n");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_EXPLICIT && exp == now + 50);
+  n = make_resp(resp, 200, "Cache-Control: no-cache\r\n");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_EXPLICIT && exp == now);
+  n = make_resp(resp, 200, "Cache-Control: no-store\r\n");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_NOSTORE);
+  n = make_resp(resp, 200, "Cache-Control: private, max-age=60\r\n");
+  CHECK(fresh_storable(resp, n, 0, now, &exp) == FRESH_NOSTORE);
+
+  // Vary가 있으면 저장 안 함 (키가 uri뿐이라 변형을 구별 못 함). 헤더만 보고도 거절
+  n = make_resp(resp, 200, "Cache-Control: max-age=60\r\nVary: Accept-Encoding\r\n");
+  CHECK(fresh_storable(resp, n, 0, now, &exp) == FRESH_NOSTORE);
+  CHECK(fresh_admit(resp, n, 0, MAX_OBJECT_SIZE) == 0);
+
+  // Authorization을 실은 요청의 응답은 public, s-maxage, must-revalidate 중 하나가 있어야 저장
+  CHECK(fresh_authorized("Host: a\r\nauthorization: Basic eDp5\r\n"));
+  CHECK(!fresh_authorized("Host: a\r\nX-Authorization: b\r\n"));
+  n = make_resp(resp, 200, "Cache-Control: max-age=60\r\n");
+  CHECK(fresh_storable(resp, n, 1, now, &exp) == FRESH_NOSTORE);
+  CHECK(fresh_admit(resp, n, 1, MAX_OBJECT_SIZE) == 0);
+  n = make_resp(resp, 200, "Cache-Control: max-age=60, publicity\r\n");
+  CHECK(fresh_storable(resp, n, 1, now, &exp) == FRESH_NOSTORE);
+  n = make_resp(resp, 200, "Cache-Control: public, max-age=60\r\n");
+  CHECK(fresh_storable(resp, n, 1, now, &exp) == FRESH_EXPLICIT && exp == now + 60);
+  n = make_resp(resp, 200, "Cache-Control: s-maxage=30\r\n");
+  CHECK(fresh_storable(resp, n, 1, now, &exp) == FRESH_EXPLICIT && exp == now + 30);
+  n = make_resp(resp, 200, "Cache-Control: max-age=60, must-revalidate\r\n");
+  CHECK(fresh_storable(resp, n, 1, now, &exp) == FRESH_EXPLICIT && exp == now + 60);
+
+  // Expires는 Date 기준, 못 읽으면 이미 만료
+  sprintf(hdrs, "Date: %s\r\nExpires: %s\r\n", http_date(d1, now), http_date(d2, now + 120));
+  n = make_resp(resp, 200, hdrs);
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_EXPLICIT && exp == now + 120);
+  n = make_resp(resp, 200, "Expires: 0\r\n");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_EXPLICIT && exp == now);
+
+  // 추정 : Last-Modified로부터 지난 시간의 10% (하루까지), 없으면 기본값
+  sprintf(hdrs, "Last-Modified: %s\r\n", http_date(d1, now - 1000));
+  n = make_resp(resp, 200, hdrs);
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_HEURISTIC && exp == now + 100);
+  sprintf(hdrs, "Last-Modified: %s\r\n", http_date(d1, now - 100 * 86400));
+  n = make_resp(resp, 200, hdrs);
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_HEURISTIC && exp == now + 86400);
+  n = make_resp(resp, 200, "");
+  CHECK(fresh_lifetime(resp, n, now, &exp) == FRESH_HEURISTIC && exp == now + 300);
+
+  // 유예 : 기본값, stale-while-revalidate, must-revalidate, 에러 응답
+  n = make_resp(resp, 200, "");
+  CHECK(fresh_grace(resp, n) == 10);
+  n = make_resp(resp, 200, "Cache-Control: max-age=60, stale-while-revalidate=30\r\n");
+  CHECK(fresh_grace(resp, n) == 30);
+  n = make_resp(resp, 200, "Cache-Control: max-age=60, must-revalidate\r\n");
+  CHECK(fresh_grace(resp, n) == 0);
+  n = make_resp(resp, 404, "");
+  CHECK(fresh_grace(resp, n) == 0);
+
+  // 상태 코드 : 404는 -N초까지만, 500은 저장 안 함, -N 0이면 404도 안 함
+  n = make_resp(resp, 404, "Cache-Control: max-age=3600\r\n");
+  CHECK(fresh_storable(resp, n, 0, now, &exp) == FRESH_EXPLICIT && exp == now + 5);
+  n = make_resp(resp, 500, "Cache-Control: max-age=3600\r\n");
+  CHECK(fresh_storable(resp, n, 0, now, &exp) == FRESH_NOSTORE);
+  fresh_init(300, 10, 0);
+  n = make_resp(resp, 404, "");
+  CHECK(fresh_storable(resp, n, 0, now, &exp) == FRESH_NOSTORE);
+
+  // 응답 끝 : Content-Length만큼, chunked는 마지막 0 청크까지
+  n = make_resp(resp, 200, "Content-Length: 5\r\n");
+  CHECK(!fresh_complete(resp, n));
+  memcpy(resp + n, "hello", 5);
+  CHECK(fresh_complete(resp, n + 5));
+  n = make_resp(resp, 200, "Transfer-Encoding: chunked\r\n");
+  n += sprintf(resp + n, "5\r\nhello\r\n");
+  CHECK(!fresh_complete(resp, n));
+  n += sprintf(resp + n, "0\r\n\r\n");
+  CHECK(fresh_complete(resp, n));
+  CHECK(fresh_admit(resp, 10, 0, MAX_OBJECT_SIZE) == -1);
+}
+
+/* 스냅샷 : 저장한 항목이 그대로 다시 올라오고 (유예까지 지난 건 빼고), 한 바이트라도 깨진 파일은 통째로 버린다 */
+static void test_snapshot(void) {
+  char path[64], uri[MAXLINE];
+  time_t now = time(NULL);
+  cache_entry *e;
+  struct stat st;
+  int fd;
+  char c;
+
+  snprintf(path, sizeof(path), "/tmp/cachetest-%d.snap", (int)getpid());
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, 1);
+  for (int i = 0; i < 20; i++) {
+    g_body[0] = 'a' + i;
+    cache_store(obj_uri(uri, i), g_body, 500 + i * 1000, 20, now + 100, 7);
+  }
+  cache_store(obj_uri(uri, 20), g_body, 500, 0, now - 100, 5);     // 유예까지 지남
+  g_body[0] = 'x';
+  CHECK(snap_save(path) == 20);
+
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, 1);
+  CHECK(snap_load(path) == 20);
+  for (int i = 0; i < 20; i++) {
+    if ((e = cache_get(obj_uri(uri, i))) == NULL) {
+      CHECK(e != NULL);
+      continue;
+    }
+    CHECK(e->size == (size_t)(500 + i * 1000) && e->hdr_len == 20);
+    CHECK(e->expires == now + 100 && e->grace == 7);
+    CHECK(e->data[0] == 'a' + i && e->data[1] == 'x');
+    cache_put(e);
+  }
+  CHECK(!resident(20));
+
+  // 본문 한가운데 한 바이트를 바꿈 -> 체크섬이 안 맞음
+  fd = Open(path, O_RDWR, 0);
+  Fstat(fd, &st);
+  CHECK(pread(fd, &c, 1, st.st_size / 2) == 1);
+  c ^= 0x55;
+  CHECK(pwrite(fd, &c, 1, st.st_size / 2) == 1);
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, DEFAULT_CACHE_SHARDS);
+  CHECK(snap_load(path) == -1);
+  CHECK(!resident(0));
+
+  // 잘린 파일
+  CHECK(ftruncate(fd, st.st_size / 2) == 0);
+  CHECK(snap_load(path) == -1);
+  Close(fd);
+  unlink(path);
+  CHECK(snap_load(path) == -1);
+}
+
+/* 음성 캐시 : ttl초 동안만 신선하고, 만료되면 다시 걸 수 있다. 진짜 객체(2xx)는 만료됐어도 안 덮는다 */
+static void test_negative(void) {
+  char resp[MAXLINE], ok[MAXLINE], uri[MAXLINE];
+  size_t n = make_resp(resp, 502, "Content-Length: 0\r\n");
+  size_t okn = make_resp(ok, 200, "Content-Length: 0\r\n");
+  time_t now = time(NULL);
+  cache_entry *e;
+
+  cache_init(MAX_CACHE_SIZE, POLICY_LRU, DEFAULT_CACHE_SHARDS);
+  memset(&g_stats, 0, sizeof(g_stats));
+
+  // -N 0이면 안 넣는다
+  cache_negative(obj_uri(uri, 1), resp, n, 0);
+  CHECK(!resident(1));
+
+  cache_negative(uri, resp, n, 30);
+  CHECK((e = cache_get(uri)) != NULL);
+  if (e) {
+    CHECK(fresh_status(e->data, e->size) == 502 && e->hdr_len == 0 && e->grace == 0);
+    CHECK(e->expires >= now + 30 && e->expires <= time(NULL) + 30);
+    cache_put(e);
+  }
+
+  // 만료된 음성 항목은 새 기한으로 다시 걸린다
+  cache_store(uri, resp, n, 0, now - 1, 0);
+  cache_negative(uri, resp, n, 30);
+  CHECK((e = cache_get(uri)) != NULL);
+  if (e) {
+    CHECK(e->expires >= now + 30);
+    cache_put(e);
+  }
+  CHECK(g_stats.negative_stores == 2);
+
+  // 만료된 2xx는 그대로 (원 서버가 돌아오면 재검증할 사본)
+  cache_store(obj_uri(uri, 2), ok, okn, 0, now - 1, 0);
+  cache_negative(uri, resp, n, 30);
+  CHECK((e = cache_get(uri)) != NULL);
+  if (e) {
+    CHECK(fresh_status(e->data, e->size) == 200 && e->expires == now - 1);
+    cache_put(e);
+  }
+  CHECK(g_stats.negative_stores == 2);
+}
+
+int main(int argc, char **argv) {
+  static const struct {
+    const char *name;
+    void (*fn)(void);
+  } tests[] = {
+    { "mixed_sizes", test_mixed_sizes },
+    { "large_objects", test_large_objects },
+    { "byte_budget", test_byte_budget },
+    { "index_resize", test_index_resize },
+    { "policy_order", test_policy_order },
+    { "tinylfu", test_tinylfu },
+    { "arc", test_arc },
+    { "freshness", test_freshness },
+    { "snapshot", test_snapshot },
+    { "negative", test_negative },
+  };
+
+  memset(g_body, 'x', sizeof(g_body));
+  for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+    int before = g_failed;
+    tests[i].fn();
+    printf("%-20s %s\n", tests[i].name, g_failed == before ? "ok" : "FAILED");
+  }
+  return g_failed ? 1 : 0;
+}
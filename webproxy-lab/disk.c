@@ -0,0 +1,257 @@
+/*
+ * disk.c - 큰 객체용 디스크 캐시 (메모리 캐시 다음 2단)
+ *
+ * MAX_OBJECT_SIZE를 넘는 응답은 메모리 캐시에 못 들어간다. -d를 주면 그런 응답을 중계하면서
+ * 스풀 디렉터리의 파일에 같이 쓰고(disk_writer), 다 받으면 색인에 올린다(disk_commit).
+ *  - 스풀 : -d 디렉터리 아래 우리만 쓰는 하위 디렉터리(DISK_SUBDIR). -d에 원래 있던 파일은 안 건드린다
+ *  - 색인 : 키 해시 -> 항목 (체인 해시 표). 메모리에만 있고 시작할 때 스풀의 *.obj는 지운다
+ *  - 예산 : 파일 크기 합이 -B를 넘지 않게 LRU 끝에서부터 지운다
+ *  - 적중 : 락 안에서 파일을 열기만 하고 보내는 건 락 밖에서 sendfile (proxy.c)
+ *    지워진 항목의 파일도 이미 연 fd로는 끝까지 읽힌다 (unlink는 이름만 지움)
+ *  - 파일 하나에 헤더(hop-by-hop 뺀 것) + 본문, 메모리 항목의 data와 같은 모양
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "cache.h"
+#include "disk.h"
+
+#define DISK_BUCKETS 4096   // 색인 체인 수 (2의 거듭제곱)
+#define DISK_SUBDIR "proxy-spool"   // -d 아래에 만드는 스풀 디렉터리
+
+typedef struct disk_entry {
+  uint64_t hash;
+  char *key;
+  long id;
+  size_t size, hdr_len;
+  time_t expires;
+  struct disk_entry *hnext;          // 해시 체인
+  struct disk_entry *prev, *next;    // LRU. head가 최근
+} disk_entry;
+
+static struct {
+  int enabled;
+  char dir[MAXLINE - 32];    // <-d>/proxy-spool. 뒤에 "/<id>.obj"가 붙어도 MAXLINE 안
+  size_t budget, used;
+  long next_id;
+  disk_entry *buckets[DISK_BUCKETS];
+  disk_entry *head, *tail;
+  pthread_mutex_t m;
+} g_disk = { .m = PTHREAD_MUTEX_INITIALIZER };
+
+static void disk_path(char *buf, long id) {
+  snprintf(buf, MAXLINE, "%s/%ld.obj", g_disk.dir, id);
+}
+
+/* disk_init - dir/proxy-spool을 스풀로 쓴다 (없으면 dir까지 만들고, 지난번 파일은 지움).
+   budget : 파일 크기 합의 상한 */
+void disk_init(char *dir, size_t budget) {
+  char path[MAXLINE];
+  DIR *d;
+  struct dirent *de;
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+    unix_error("disk_init: mkdir error");
+  }
+  if (snprintf(g_disk.dir, sizeof(g_disk.dir), "%s/%s", dir, DISK_SUBDIR) >= (int)sizeof(g_disk.dir)) {
+    app_error("disk_init: spool path too long");
+  }
+  if (mkdir(g_disk.dir, 0700) < 0 && errno != EEXIST) {
+    unix_error("disk_init: mkdir error");
+  }
+  if ((d = opendir(g_disk.dir)) == NULL) {
+    unix_error("disk_init: opendir error");
+  }
+  // 우리가 만든 이름(<숫자>.obj)만 지운다
+  while ((de = readdir(d)) != NULL) {
+    char *end;
+    long id = strtol(de->d_name, &end, 10);
+    if (end != de->d_name && !strcmp(end, ".obj")) {
+      disk_path(path, id);
+      unlink(path);
+    }
+  }
+  closedir(d);
+  g_disk.budget = budget;
+  g_disk.enabled = 1;
+}
+
+int disk_enabled(void) {
+  return g_disk.enabled;
+}
+
+static void lru_unlink(disk_entry *e) {
+  if (e->prev) {
+    e->prev->next = e->next;
+  }
+  else {
+    g_disk.head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  }
+  else {
+    g_disk.tail = e->prev;
+  }
+}
+
+static void lru_push(disk_entry *e) {
+  e->prev = NULL;
+  e->next = g_disk.head;
+  if (g_disk.head) {
+    g_disk.head->prev = e;
+  }
+  else {
+    g_disk.tail = e;
+  }
+  g_disk.head = e;
+}
+
+/* 락 안에서. 키로 찾기 */
+static disk_entry *find(uint64_t hash, char *key) {
+  disk_entry *e = g_disk.buckets[hash & (DISK_BUCKETS - 1)];
+
+  while (e && (e->hash != hash || strcmp(e->key, key))) {
+    e = e->hnext;
+  }
+  return e;
+}
+
+/* 락 안에서. 색인과 LRU에서 빼고 파일을 지운다 */
+static void drop(disk_entry *e) {
+  char path[MAXLINE];
+  disk_entry **pp = &g_disk.buckets[e->hash & (DISK_BUCKETS - 1)];
+
+  while (*pp != e) {
+    pp = &(*pp)->hnext;
+  }
+  *pp = e->hnext;
+  lru_unlink(e);
+  g_disk.used -= e->size;
+  disk_path(path, e->id);
+  unlink(path);
+  Free(e->key);
+  Free(e);
+}
+
+/* disk_begin - 새 스풀 파일을 연다. 0(성공), -1(꺼져 있거나 에러) */
+int disk_begin(disk_writer *w) {
+  char path[MAXLINE];
+
+  if (!g_disk.enabled) {
+    return -1;
+  }
+  pthread_mutex_lock(&g_disk.m);
+  w->id = g_disk.next_id++;
+  pthread_mutex_unlock(&g_disk.m);
+  disk_path(path, w->id);
+  if ((w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+    return -1;
+  }
+  w->written = 0;
+  w->failed = 0;
+  return 0;
+}
+
+/* disk_write - 스풀 파일 끝에 붙인다. 에러나 예산 초과면 failed (이후 쓰기는 무시). 0(성공), -1 */
+int disk_write(disk_writer *w, const void *buf, size_t n) {
+  if (w->failed) {
+    return -1;
+  }
+  if (w->written + n > g_disk.budget || rio_writen(w->fd, (void *)buf, n) != (ssize_t)n) {
+    w->failed = 1;
+    return -1;
+  }
+  w->written += n;
+  return 0;
+}
+
+/* disk_abort - 다 못 받은 응답. 파일을 지운다 */
+void disk_abort(disk_writer *w) {
+  char path[MAXLINE];
+
+  close(w->fd);
+  disk_path(path, w->id);
+  unlink(path);
+}
+
+/* disk_commit - 다 받은 응답을 key로 색인에 올린다. 같은 키의 옛 파일은 지우고,
+   예산을 넘으면 LRU 끝에서부터 지운다 */
+void disk_commit(disk_writer *w, char *key, size_t hdr_len, time_t expires) {
+  uint64_t hash = cache_hash(key);
+  disk_entry *e, *old;
+
+  if (w->failed) {
+    disk_abort(w);
+    return;
+  }
+  close(w->fd);
+  e = Malloc(sizeof(disk_entry));
+  e->hash = hash;
+  e->key = strdup(key);
+  e->id = w->id;
+  e->size = w->written;
+  e->hdr_len = hdr_len;
+  e->expires = expires;
+
+  pthread_mutex_lock(&g_disk.m);
+  if ((old = find(hash, key)) != NULL) {
+    drop(old);
+  }
+  while (g_disk.tail && g_disk.used + e->size > g_disk.budget) {
+    drop(g_disk.tail);
+    STAT_INC(disk_evictions);
+  }
+  e->hnext = g_disk.buckets[hash & (DISK_BUCKETS - 1)];
+  g_disk.buckets[hash & (DISK_BUCKETS - 1)] = e;
+  lru_push(e);
+  g_disk.used += e->size;
+  pthread_mutex_unlock(&g_disk.m);
+  STAT_INC(disk_stores);
+}
+
+/* disk_open - key가 있고 아직 신선하면 파일을 열어서 h에. 1(적중), 0(없음). 만료된 건 지운다 */
+int disk_open(char *key, disk_hit *h) {
+  uint64_t hash;
+  char path[MAXLINE];
+  disk_entry *e;
+  int found = 0;
+
+  if (!g_disk.enabled) {
+    return 0;
+  }
+  hash = cache_hash(key);
+  pthread_mutex_lock(&g_disk.m);
+  if ((e = find(hash, key)) != NULL) {
+    if (e->expires <= time(NULL)) {
+      drop(e);
+    }
+    else {
+      disk_path(path, e->id);
+      if ((h->fd = open(path, O_RDONLY)) >= 0) {
+        h->size = e->size;
+        h->hdr_len = e->hdr_len;
+        lru_unlink(e);
+        lru_push(e);
+        found = 1;
+      }
+    }
+  }
+  pthread_mutex_unlock(&g_disk.m);
+  return found;
+}
+
+/* disk_remove - key 항목을 지운다 (새 버전이 메모리 캐시로 갔을 때) */
+void disk_remove(char *key) {
+  uint64_t hash;
+  disk_entry *e;
+
+  if (!g_disk.enabled) {
+    return;
+  }
+  hash = cache_hash(key);
+  pthread_mutex_lock(&g_disk.m);
+  if ((e = find(hash, key)) != NULL) {
+    drop(e);
+  }
+  pthread_mutex_unlock(&g_disk.m);
+}
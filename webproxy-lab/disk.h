@@ -0,0 +1,33 @@
+/*
+ * disk.h - MAX_OBJECT_SIZE보다 큰 응답을 위한 디스크 캐시 (2단, -d 스풀 디렉터리)
+ */
+#ifndef __DISK_H__
+#define __DISK_H__
+
+#include "csapp.h"
+
+// 채우는 중인 스풀 파일. disk_commit 전에는 아무도 못 본다
+typedef struct {
+  int fd;
+  long id;               // 파일 이름 <dir>/<id>.obj
+  size_t written;
+  int failed;            // 쓰다가 에러. commit해도 버림
+} disk_writer;
+
+// disk_open 결과. 다 보내면 fd를 close
+typedef struct {
+  int fd;
+  size_t size;           // 파일 전체 (헤더 + 본문)
+  size_t hdr_len;        // 앞쪽 응답 헤더 (cache_entry와 같음)
+} disk_hit;
+
+void disk_init(char *dir, size_t budget);
+int disk_enabled(void);
+int disk_begin(disk_writer *w);
+int disk_write(disk_writer *w, const void *buf, size_t n);
+void disk_commit(disk_writer *w, char *key, size_t hdr_len, time_t expires);
+void disk_abort(disk_writer *w);
+int disk_open(char *key, disk_hit *h);
+void disk_remove(char *key);
+
+#endif /* __DISK_H__ */
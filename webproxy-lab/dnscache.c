@@ -0,0 +1,299 @@
+/*
+ * dnscache.c - 원 서버 이름 해석 캐시
+ *
+ * open_clientfd는 연결마다 getaddrinfo를 부른다. 프록시가 붙는 원 서버는 몇 개 안 되니까
+ * (host, port)별로 결과를 ttl초 동안 기억한다.
+ *  - 실패(NXDOMAIN 등)도 DNS_NEG_TTL초 동안 기억해서 같은 이름으로 계속 막히지 않게
+ *  - 만료가 다가오는데 그동안 조회된(핫한) 항목은 백그라운드 쓰레드가 미리 다시 해석한다.
+ *    요청 쓰레드는 핫한 이름 때문에 getaddrinfo를 기다릴 일이 거의 없음
+ *  - 해석은 항상 락 밖에서. 락 안에서는 표만 본다
+ *  - connect는 주소들을 non-blocking으로 경주시키고 기한(-T)을 둔다. 한 주소 패밀리가
+ *    먹통이어도 커널 connect 타임아웃(수십 초)만큼 쓰레드가 묶이지 않게
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "dnscache.h"
+#include <poll.h>
+
+#define DNS_ENTRIES   128   // 기억하는 (host, port) 개수
+#define DNS_NEG_TTL   5     // 실패를 기억하는 시간 (초)
+#define DNS_REFRESH_N 16    // 백그라운드 쓰레드가 한 번에 갱신하는 최대 개수
+#define CONNECT_STAGGER_MS 250   // 다음 주소로 connect를 겹쳐 시작하기까지 (RFC 8305 권장값)
+
+typedef struct {
+  char host[256];           // 비어 있으면 안 쓰는 슬롯
+  char port[16];
+  int ok;                   // 0이면 실패를 기억하는 음성 항목
+  dns_result res;
+  time_t expires;
+  time_t last_use;
+  int hits;                 // 마지막 해석 이후 조회 수 (0이 아니면 핫한 항목)
+  int refreshing;           // 백그라운드 쓰레드가 해석 중
+} dns_entry;
+
+static dns_entry table[DNS_ENTRIES];
+static int dns_ttl;
+static pthread_mutex_t dns_m = PTHREAD_MUTEX_INITIALIZER;
+
+/* getaddrinfo를 불러서 res에 복사. 0(성공), -1(실패) */
+static int resolve(char *host, char *port, dns_result *res) {
+  struct addrinfo hints, *list, *p;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+  if (getaddrinfo(host, port, &hints, &list) != 0) {
+    return -1;
+  }
+  res->naddr = 0;
+  for (p = list; p && res->naddr < DNS_MAX_ADDRS; p = p->ai_next) {
+    dns_addr *a = &res->addrs[res->naddr++];
+    a->family = p->ai_family;
+    a->socktype = p->ai_socktype;
+    a->protocol = p->ai_protocol;
+    a->addrlen = p->ai_addrlen;
+    memcpy(&a->addr, p->ai_addr, p->ai_addrlen);
+  }
+  freeaddrinfo(list);
+  return res->naddr > 0 ? 0 : -1;
+}
+
+/* (host, port) 항목. 락 잡고 호출 */
+static dns_entry *find(char *host, char *port) {
+  for (int i = 0; i < DNS_ENTRIES; i++) {
+    if (!strcmp(table[i].host, host) && !strcmp(table[i].port, port)) {
+      return &table[i];
+    }
+  }
+  return NULL;
+}
+
+/* 해석 결과를 표에 넣는다. 자리가 없으면 제일 오래 안 쓴 항목을 덮어씀. 락 잡고 호출 */
+static void store(char *host, char *port, int ok, dns_result *res, time_t now) {
+  dns_entry *e = find(host, port);
+
+  if (!e) {
+    e = &table[0];
+    for (int i = 1; i < DNS_ENTRIES && e->host[0]; i++) {
+      if (!table[i].host[0] || table[i].last_use < e->last_use) {
+        e = &table[i];
+      }
+    }
+    strcpy(e->host, host);
+    strcpy(e->port, port);
+    e->last_use = now;
+    e->refreshing = 0;
+  }
+  e->ok = ok;
+  if (ok) {
+    e->res = *res;
+  }
+  e->expires = now + (ok ? dns_ttl : DNS_NEG_TTL);
+  e->hits = 0;
+}
+
+/* 백그라운드 갱신 : 1초마다 만료가 ttl/4 안으로 다가온 핫한 항목을 다시 해석한다 */
+static void *refresher(void *vargp) {
+  Pthread_detach(pthread_self());
+
+  while (1) {
+    char hosts[DNS_REFRESH_N][256], ports[DNS_REFRESH_N][16];
+    int n = 0;
+    time_t now = time(NULL);
+    int window = dns_ttl / 4 > 1 ? dns_ttl / 4 : 1;
+
+    pthread_mutex_lock(&dns_m);
+    for (int i = 0; i < DNS_ENTRIES && n < DNS_REFRESH_N; i++) {
+      dns_entry *e = &table[i];
+      if (e->host[0] && e->ok && e->hits > 0 && !e->refreshing && e->expires - now <= window) {
+        e->refreshing = 1;
+        strcpy(hosts[n], e->host);
+        strcpy(ports[n], e->port);
+        n++;
+      }
+    }
+    pthread_mutex_unlock(&dns_m);
+
+    for (int i = 0; i < n; i++) {
+      dns_result res;
+      int ok = resolve(hosts[i], ports[i], &res) == 0;
+      pthread_mutex_lock(&dns_m);
+      dns_entry *e = find(hosts[i], ports[i]);
+      if (e) {
+        e->refreshing = 0;
+        // 갱신이 실패하면 기존 주소를 남은 TTL 동안 그대로 쓴다
+        if (ok) {
+          store(hosts[i], ports[i], 1, &res, time(NULL));
+        }
+      }
+      pthread_mutex_unlock(&dns_m);
+      STAT_INC(dns_refreshes);
+    }
+    sleep(1);
+  }
+  return NULL;
+}
+
+/* ttl이 0이면 캐시를 쓰지 않는다 (dns_lookup이 매번 getaddrinfo) */
+void dns_init(int ttl) {
+  pthread_t tid;
+
+  dns_ttl = ttl;
+  if (dns_ttl > 0) {
+    Pthread_create(&tid, NULL, refresher, NULL);
+  }
+}
+
+/*
+ * dns_lookup - host:port의 주소들을 res에 채운다. 0(성공), -1(해석 실패)
+ *     캐시에 살아 있으면 표에서 복사만, 아니면 getaddrinfo 후 기억한다
+ */
+int dns_lookup(char *host, char *port, dns_result *res) {
+  time_t now = time(NULL);
+  int ok;
+
+  if (dns_ttl <= 0 || strlen(host) >= sizeof(table[0].host) || strlen(port) >= sizeof(table[0].port)) {
+    return resolve(host, port, res);
+  }
+
+  pthread_mutex_lock(&dns_m);
+  dns_entry *e = find(host, port);
+  if (e && now < e->expires) {
+    ok = e->ok;
+    if (ok) {
+      *res = e->res;
+    }
+    e->hits++;
+    e->last_use = now;
+    pthread_mutex_unlock(&dns_m);
+    STAT_INC(dns_hits);
+    return ok ? 0 : -1;
+  }
+  pthread_mutex_unlock(&dns_m);
+
+  STAT_INC(dns_misses);
+  ok = resolve(host, port, res) == 0;
+  pthread_mutex_lock(&dns_m);
+  store(host, port, ok, res, now);
+  pthread_mutex_unlock(&dns_m);
+  return ok ? 0 : -1;
+}
+
+/* 주소 순서 : IPv6, IPv4를 번갈아 (getaddrinfo가 준 순서는 패밀리 안에서 유지) */
+static int interleave(dns_result *res, dns_addr **order) {
+  int n = 0, i6 = 0, i4 = 0;
+
+  while (n < res->naddr) {
+    while (i6 < res->naddr && res->addrs[i6].family != AF_INET6) {
+      i6++;
+    }
+    if (i6 < res->naddr) {
+      order[n++] = &res->addrs[i6++];
+    }
+    while (i4 < res->naddr && res->addrs[i4].family == AF_INET6) {
+      i4++;
+    }
+    if (i4 < res->naddr) {
+      order[n++] = &res->addrs[i4++];
+    }
+  }
+  return n;
+}
+
+static long now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * race_connect - "happy eyeballs" (RFC 8305) connect. 주소를 하나씩 non-blocking으로 시작하고,
+ *     CONNECT_STAGGER_MS 안에 안 붙으면(또는 실패하면) 다음 주소를 겹쳐서 시작한다.
+ *     처음 붙은 소켓을 blocking으로 돌려서 리턴, 나머지는 닫는다.
+ *     timeout_ms 안에 아무것도 안 붙으면 -1 (errno = ETIMEDOUT). 다 거절당해도 -1
+ */
+static int race_connect(dns_result *res, int timeout_ms) {
+  dns_addr *order[DNS_MAX_ADDRS];
+  struct pollfd pfds[DNS_MAX_ADDRS];
+  int n = interleave(res, order), next = 0, npending = 0, winner = -1;
+  long deadline = now_ms() + timeout_ms, next_start = 0;
+
+  while (winner < 0) {
+    long now = now_ms();
+    // 시도 중인 게 없거나 stagger가 지났으면 다음 주소 시작
+    if (next < n && (npending == 0 || now >= next_start)) {
+      dns_addr *a = order[next++];
+      int fd = socket(a->family, a->socktype | SOCK_NONBLOCK, a->protocol);
+      next_start = now;     // 바로 실패하면 기다리지 않고 다음 주소
+      if (fd < 0) {
+        continue;
+      }
+      if (connect(fd, (SA *)&a->addr, a->addrlen) == 0) {
+        winner = fd;
+        break;
+      }
+      if (errno != EINPROGRESS) {
+        close(fd);
+        continue;
+      }
+      pfds[npending].fd = fd;
+      pfds[npending].events = POLLOUT;
+      npending++;
+      next_start = now + CONNECT_STAGGER_MS;
+      continue;
+    }
+    if (npending == 0) {
+      return -1;    // 모든 주소가 바로 거절
+    }
+    if (now >= deadline) {
+      STAT_INC(connect_timeouts);
+      errno = ETIMEDOUT;
+      break;
+    }
+    long wait = deadline - now;
+    if (next < n && next_start - now < wait) {
+      wait = next_start - now;
+    }
+    if (poll(pfds, npending, wait) < 0 && errno != EINTR) {
+      break;
+    }
+    for (int i = 0; i < npending && winner < 0; i++) {
+      if (!pfds[i].revents) {
+        continue;
+      }
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err == 0) {
+        winner = pfds[i].fd;
+        pfds[i] = pfds[--npending];
+        break;
+      }
+      // 실패한 주소는 빼고 다음 주소를 바로 시작
+      close(pfds[i].fd);
+      pfds[i--] = pfds[--npending];
+      next_start = now;
+    }
+  }
+  for (int i = 0; i < npending; i++) {
+    close(pfds[i].fd);
+  }
+  if (winner >= 0) {
+    fcntl(winner, F_SETFL, fcntl(winner, F_GETFL) & ~O_NONBLOCK);
+  }
+  return winner;
+}
+
+/*
+ * dns_connect - open_clientfd와 같은 일을 캐시된 주소로 한다.
+ *     주소들을 race_connect로 경주시켜 처음 붙은 소켓. 실패하거나
+ *     g_conf.connect_ms 안에 못 붙으면 -1
+ */
+int dns_connect(char *host, char *port) {
+  dns_result res;
+
+  if (dns_lookup(host, port, &res) < 0) {
+    return -1;
+  }
+  return race_connect(&res, g_conf.connect_ms);
+}
@@ -0,0 +1,27 @@
+/*
+ * dnscache.h - 원 서버 주소 캐시 (getaddrinfo 결과를 TTL 동안 재사용)
+ */
+#ifndef __DNSCACHE_H__
+#define __DNSCACHE_H__
+
+#include "csapp.h"
+
+#define DNS_MAX_ADDRS 8   // 이름 하나당 기억하는 주소 수
+
+// getaddrinfo 결과 한 개 (addrinfo 리스트를 복사해서 락 밖에서 쓰려고)
+typedef struct {
+  int family, socktype, protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+} dns_addr;
+
+typedef struct {
+  int naddr;
+  dns_addr addrs[DNS_MAX_ADDRS];
+} dns_result;
+
+void dns_init(int ttl);
+int dns_lookup(char *host, char *port, dns_result *res);
+int dns_connect(char *host, char *port);
+
+#endif /* __DNSCACHE_H__ */
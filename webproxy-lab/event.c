@@ -0,0 +1,748 @@
+/*
+ * event.c - non-blocking epoll 엔진 (-m epoll)
+ *
+ * 쓰레드 모델은 Rio_readlineb, Open_clientfd, 중계 루프에서 쓰레드 하나가 통째로 막힌다.
+ * 여기서는 연결 하나를 상태 기계 하나로 보고, 코어마다 epoll 루프를 하나씩 돌려서
+ * 막히는 호출 없이 여러 연결을 번갈아 진행시킨다.
+ * 요청 파싱, 헤더 재작성, 캐시는 proxy.c에 있는 걸 그대로 쓴다.
+ *
+ * -R을 주면 루프마다 SO_REUSEPORT 리스너를 따로 열고 루프를 코어 하나에 고정한다.
+ * 커널이 accept를 리스너들에 나눠 주니까 accept 하나로 몰리지 않는다.
+ *
+ * 타이머 : 연결마다 기한이 있고 epoll_wait의 timeout으로 깨서 지난 것들을 정리한다.
+ *  - connect 중이면 -T(connect_ms) 안에 못 붙으면 502 (쓰레드 모델의 race_connect와 같은 기한)
+ *  - 그 밖의 상태는 클라이언트든 원 서버든 CONN_IDLE_SECS 동안 아무 이벤트가 없으면 닫는다
+ * 기한이 상태별로 고정 길이라 리스트 끝에 붙이기만 하면 기한 순서가 된다 (앞에서부터만 보면 됨)
+ *
+ * 한계 : 원 서버 이름 풀이는 dnscache를 거치지만, 캐시에 없는 이름은 루프 안에서 blocking으로 한다.
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "dnscache.h"
+#include "cache.h"
+#include "fresh.h"
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+
+#define MAX_EVENTS 256
+#define INBUF_INIT 1024            // 요청 버퍼 시작 크기 (필요하면 두 배씩 키움)
+#define INBUF_SIZE (MAXLINE * 4)   // 요청 라인 + 헤더 최대 크기
+#define RELAY_SIZE MAXBUF          // 원 서버 -> 클라이언트 한 번에 옮기는 크기
+#define RELAY_BURST 8              // 이벤트 한 번에 최대 몇 번 읽을지 (다른 연결 굶지 않게)
+#define CONN_IDLE_SECS 30          // 이만큼 아무 진행이 없는 연결은 닫는다 (요청 대기, 중계, 응답 쓰기)
+
+// 연결 상태
+enum {
+  ST_READ_LINE,     // 요청 라인 읽는 중
+  ST_READ_HEADERS,  // 헤더를 빈 줄까지 읽는 중
+  ST_CONNECTING,    // 원 서버에 non-blocking connect 진행 중
+  ST_SEND_REQUEST,  // 재조립한 요청을 원 서버에 쓰는 중
+  ST_RELAY,         // 원 서버 응답을 클라이언트로 중계하는 중
+  ST_SERVE,         // 캐시에서 꺼낸 응답(또는 에러 응답)을 쓰는 중
+};
+
+typedef struct conn conn;
+
+// 기한 순서로 늘어선 연결들 (앞이 제일 먼저 지남)
+typedef struct {
+  conn *head, *tail;
+} timer_list;
+
+// epoll_event.data.ptr에 들어가는 것. 어느 연결의 어느 쪽 fd인지 구분
+typedef struct {
+  conn *c;
+  int is_server;
+} endpoint;
+
+struct conn {
+  int state;
+  int closed;                 // 닫혔지만 이번 epoll_wait 묶음이 끝날 때까지 free 보류
+  int clientfd, serverfd;
+  endpoint cli_ep, srv_ep;
+  unsigned cli_events, srv_events;   // 지금 epoll에 걸어둔 이벤트 (0이면 등록 안 됨)
+
+  char *in;                   // 클라이언트가 보낸 요청 라인 + 헤더
+  size_t inlen, incap;
+  size_t scan;                // 빈 줄을 어디까지 찾아봤는지
+
+  char *uri;                  // 캐시 키
+  dns_result *addrs;          // connect 후보 주소들 (dnscache에서 복사)
+  int addr_next;              // 다음에 시도할 주소
+
+  char *req;                  // 원 서버로 보낼 요청
+  size_t reqlen, reqoff;
+
+  char *out;                  // 클라이언트로 나갈 바이트 (캐시 응답, 에러, 중계 버퍼)
+  cache_entry *pin;           // 캐시 적중이면 out은 이 항목의 data (free 말고 cache_put)
+  size_t outlen, outoff;
+
+  char *chebuf;               // 캐시에 넣을 응답 누적
+  size_t accumulated, checap;
+  int is_cacheable;
+  int admit;                  // 헤더로 정한 fresh_admit 결과 (-1이면 아직 헤더가 덜 옴)
+  int auth;                   // 요청에 Authorization이 있었음 (fresh_storable)
+
+  long deadline;              // 이 시각(ms, CLOCK_MONOTONIC)이 지나면 timer_expire
+  timer_list *tlist;          // 들어 있는 타이머 리스트 (NULL이면 없음)
+  conn *tprev, *tnext;
+
+  conn *next_dead;
+};
+
+typedef struct {
+  int epfd;
+  int listenfd;
+  int cpu;                     // 고정할 코어 (-1이면 고정 안 함)
+  endpoint listen_ep;
+  conn *dead;                  // 이번 묶음에서 닫힌 연결들
+  timer_list idle;             // CONN_IDLE_SECS 기한
+  timer_list connecting;       // connect_ms 기한
+  char scratch[REQ_BUFSIZE];   // build_request / format_error 용
+} loop_t;
+
+static void conn_close(loop_t *lp, conn *c);
+
+static long now_ms(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void timer_unlink(conn *c) {
+  timer_list *tl = c->tlist;
+
+  if (tl == NULL) {
+    return;
+  }
+  if (c->tprev) {
+    c->tprev->tnext = c->tnext;
+  }
+  else {
+    tl->head = c->tnext;
+  }
+  if (c->tnext) {
+    c->tnext->tprev = c->tprev;
+  }
+  else {
+    tl->tail = c->tprev;
+  }
+  c->tprev = c->tnext = NULL;
+  c->tlist = NULL;
+}
+
+/* 지금 상태의 기한을 새로 잡는다 (리스트 끝으로) */
+static void timer_arm(loop_t *lp, conn *c) {
+  int connecting = c->state == ST_CONNECTING;
+  timer_list *tl = connecting ? &lp->connecting : &lp->idle;
+
+  timer_unlink(c);
+  c->deadline = now_ms() + (connecting ? g_conf.connect_ms : CONN_IDLE_SECS * 1000L);
+  c->tlist = tl;
+  c->tprev = tl->tail;
+  c->tnext = NULL;
+  if (tl->tail) {
+    tl->tail->tnext = c;
+  }
+  else {
+    tl->head = c;
+  }
+  tl->tail = c;
+}
+
+/* fd에 걸어둘 이벤트를 바꾼다. 0이면 epoll에서 뺀다 */
+static void watch(loop_t *lp, conn *c, int is_server, unsigned events) {
+  unsigned *cur = is_server ? &c->srv_events : &c->cli_events;
+  int fd = is_server ? c->serverfd : c->clientfd;
+  struct epoll_event ev;
+
+  if (*cur == events) {
+    return;
+  }
+  ev.events = events;
+  ev.data.ptr = is_server ? &c->srv_ep : &c->cli_ep;
+  if (events == 0) {
+    epoll_ctl(lp->epfd, EPOLL_CTL_DEL, fd, NULL);
+  }
+  else if (*cur == 0) {
+    epoll_ctl(lp->epfd, EPOLL_CTL_ADD, fd, &ev);
+  }
+  else {
+    epoll_ctl(lp->epfd, EPOLL_CTL_MOD, fd, &ev);
+  }
+  *cur = events;
+}
+
+static void close_server(loop_t *lp, conn *c) {
+  if (c->serverfd >= 0) {
+    watch(lp, c, 1, 0);
+    close(c->serverfd);
+    c->serverfd = -1;
+  }
+}
+
+/* 클라이언트에 보낼 응답을 정하고 ST_SERVE로. buf는 복사해서 들고 있는다 */
+static void serve(loop_t *lp, conn *c, char *buf, size_t n) {
+  close_server(lp, c);
+  free(c->out);
+  c->out = Malloc(n);
+  memcpy(c->out, buf, n);
+  c->outlen = n;
+  c->outoff = 0;
+  c->state = ST_SERVE;
+  watch(lp, c, 0, EPOLLOUT);
+}
+
+/* 캐시 적중 : 항목을 잡아 둔 채로 그 저장소에서 바로 보낸다 (conn_free에서 cache_put) */
+static void serve_entry(loop_t *lp, conn *c, cache_entry *e) {
+  close_server(lp, c);
+  c->pin = e;
+  c->out = e->data;
+  c->outlen = e->size;
+  c->outoff = 0;
+  c->state = ST_SERVE;
+  watch(lp, c, 0, EPOLLOUT);
+}
+
+static void serve_error(loop_t *lp, conn *c, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+  int n = format_error(lp->scratch, cause, errnum, shortmsg, longmsg);
+  serve(lp, c, lp->scratch, n);
+}
+
+/* 원 서버에 못 붙음 (이름 해석이나 connect 실패). 502를 보내고 음성 캐시에도.
+   만료된 진짜 객체가 있으면 cache_negative가 덮지 않는다 (cache.c) */
+static void origin_unreachable(loop_t *lp, conn *c, char *cause) {
+  int n = format_error(lp->scratch, cause, "502", "Bad Gateway", "Failed to connect to origin");
+  cache_negative(c->uri, lp->scratch, n, g_conf.neg_ttl);
+  serve(lp, c, lp->scratch, n);
+}
+
+/* out에 남은 걸 클라이언트에 쓴다. 1 : 다 씀, 0 : 소켓이 꽉 참, -1 : 에러 */
+static int flush_client(conn *c) {
+  while (c->outoff < c->outlen) {
+    ssize_t n = write(c->clientfd, c->out + c->outoff, c->outlen - c->outoff);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    c->outoff += n;
+  }
+  return 1;
+}
+
+/* 후보 주소를 차례로 non-blocking connect. 다 실패하면 502 */
+static void start_connect(loop_t *lp, conn *c) {
+  while (c->addr_next < c->addrs->naddr) {
+    dns_addr *p = &c->addrs->addrs[c->addr_next++];
+
+    int fd = socket(p->family, p->socktype | SOCK_NONBLOCK, p->protocol);
+    if (fd < 0) {
+      continue;
+    }
+    c->serverfd = fd;
+    c->srv_events = 0;
+    if (connect(fd, (SA *)&p->addr, p->addrlen) == 0) {
+      c->state = ST_SEND_REQUEST;
+      watch(lp, c, 1, EPOLLOUT);
+      return;
+    }
+    if (errno == EINPROGRESS) {
+      c->state = ST_CONNECTING;
+      watch(lp, c, 1, EPOLLOUT);
+      // 기한은 후보 전체에 한 번 (다음 주소로 넘어가도 이어서 셈)
+      if (c->tlist != &lp->connecting) {
+        timer_arm(lp, c);
+      }
+      return;
+    }
+    close(fd);
+    c->serverfd = -1;
+  }
+  origin_unreachable(lp, c, "");
+}
+
+/* 요청 라인 + 헤더가 다 모였을 때. 캐시를 보고 적중하면 바로 응답, 아니면 connect 시작 */
+static void start_request(loop_t *lp, conn *c) {
+  char method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char host[MAXLINE], path[MAXLINE], port[16] = "80";
+  char raw_header[MAXLINE * 4], host_hdr[MAXLINE], line[MAXLINE];
+  char *p = c->in, *end = c->in + c->inlen;
+  char *eol = memchr(p, '\n', end - p);
+  size_t len = eol - p + 1;
+
+  // c->in은 NUL로 안 끝나니까 줄을 잘라서 sscanf
+  if (len >= sizeof(line)) {
+    len = sizeof(line) - 1;
+  }
+  memcpy(line, p, len);
+  line[len] = '\0';
+  method[0] = uri[0] = version[0] = '\0';
+  if (sscanf(line, "%s %s %s", method, uri, version) < 2) {
+    serve_error(lp, c, method, "400", "Bad Request", "Malformed request line");
+    return;
+  }
+  p = eol + 1;
+
+  // 헤더 한 줄씩 쓰레드 모델과 같은 규칙으로 누적
+  raw_header[0] = '\0';
+  host_hdr[0] = '\0';
+  while (p < end && (eol = memchr(p, '\n', end - p)) != NULL) {
+    len = eol - p + 1;
+    if (len >= sizeof(line)) {
+      len = sizeof(line) - 1;
+    }
+    memcpy(line, p, len);
+    line[len] = '\0';
+    p = eol + 1;
+    if (!strcmp(line, "\r\n")) {
+      break;
+    }
+    add_header_line(line, raw_header, sizeof(raw_header), host_hdr, sizeof(host_hdr));
+  }
+
+  parse_uri(uri, host, path, port, host_hdr);
+  if (host[0] == '\0') {
+    serve_error(lp, c, uri, "400", "Bad Request", "No host in request");
+    return;
+  }
+  cache_key(uri, sizeof(uri), host, port, path);   // 여기부터 uri는 캐시 키
+  c->uri = strdup(uri);
+
+  // 캐시 적중. 만료된 항목은 재검증 없이 다시 받는다 (유예 시간도 안 씀)
+  cache_entry *hit = cache_get(uri);
+  if (hit && __atomic_load_n(&hit->expires, __ATOMIC_RELAXED) <= time(NULL)) {
+    STAT_INC(cache_stale);
+    cache_put(hit);
+    hit = NULL;
+  }
+  if (hit) {
+    serve_entry(lp, c, hit);
+    return;
+  }
+
+  // 캐시 미스 : 요청 재조립 후 connect (build_request가 raw_header를 자르니까 그 전에 auth)
+  c->auth = fresh_authorized(raw_header);
+  int n = build_request(host, path, port, raw_header, lp->scratch, 0);
+  c->req = Malloc(n);
+  memcpy(c->req, lp->scratch, n);
+  c->reqlen = n;
+  c->reqoff = 0;
+
+  // 캐시에 없는 이름이면 여기서 getaddrinfo를 기다린다 (루프가 잠깐 멈춤)
+  c->addrs = Malloc(sizeof(dns_result));
+  c->addr_next = 0;
+  if (dns_lookup(host, port, c->addrs) < 0) {
+    origin_unreachable(lp, c, host);
+    return;
+  }
+  c->is_cacheable = 1;
+  c->admit = -1;
+  start_connect(lp, c);
+}
+
+/* 요청 라인과 헤더를 모은다 */
+static void on_client_read(loop_t *lp, conn *c) {
+  while (1) {
+    if (c->inlen == c->incap) {
+      if (c->incap == INBUF_SIZE) {
+        serve_error(lp, c, "", "400", "Bad Request", "Request header too large");
+        return;
+      }
+      c->incap = c->incap * 2 > INBUF_SIZE ? INBUF_SIZE : c->incap * 2;
+      c->in = Realloc(c->in, c->incap);
+    }
+    ssize_t n = read(c->clientfd, c->in + c->inlen, c->incap - c->inlen);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n <= 0) {
+      // 요청을 다 보내기 전에 끊김
+      conn_close(lp, c);
+      return;
+    }
+    c->inlen += n;
+  }
+
+  // 1단계 : 요청 라인. method는 get만 허용
+  if (c->state == ST_READ_LINE) {
+    char *eol = memchr(c->in, '\n', c->inlen);
+    if (eol == NULL) {
+      return;
+    }
+    size_t len = strcspn(c->in, " \r\n");
+    if (len != 3 || strncasecmp(c->in, "GET", 3)) {
+      char method[16];
+      snprintf(method, sizeof(method), "%.*s", (int)len, c->in);
+      serve_error(lp, c, method, "501", "Not implemented", "Server does not implement this method.");
+      return;
+    }
+    c->state = ST_READ_HEADERS;
+    c->scan = eol - c->in + 1;
+  }
+
+  // 2단계 : 빈 줄 찾기
+  while (c->scan < c->inlen) {
+    char *eol = memchr(c->in + c->scan, '\n', c->inlen - c->scan);
+    if (eol == NULL) {
+      return;
+    }
+    size_t start = c->scan;
+    c->scan = eol - c->in + 1;
+    if (c->scan - start == 2 && c->in[start] == '\r') {
+      watch(lp, c, 0, 0);
+      start_request(lp, c);
+      return;
+    }
+  }
+}
+
+static void on_server_write(loop_t *lp, conn *c) {
+  if (c->state == ST_CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->serverfd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+      // 이 주소는 실패, 다음 후보로
+      close_server(lp, c);
+      start_connect(lp, c);
+      return;
+    }
+    c->state = ST_SEND_REQUEST;
+  }
+
+  while (c->reqoff < c->reqlen) {
+    ssize_t n = write(c->serverfd, c->req + c->reqoff, c->reqlen - c->reqoff);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      serve_error(lp, c, "", "502", "Bad Gateway", "Failed to send request to origin");
+      return;
+    }
+    c->reqoff += n;
+  }
+
+  // 요청 다 보냄 -> 응답 중계
+  c->state = ST_RELAY;
+  c->out = Malloc(RELAY_SIZE);
+  c->outlen = c->outoff = 0;
+  watch(lp, c, 1, EPOLLIN);
+}
+
+/* 캐시에 넣을 사본 누적. MAX_OBJECT_SIZE를 넘거나 헤더를 보니 못 넣을 응답이면 포기 */
+static void accumulate(conn *c, char *buf, size_t n) {
+  if (!c->is_cacheable) {
+    return;
+  }
+  if (c->accumulated + n > MAX_OBJECT_SIZE) {
+    c->is_cacheable = 0;
+    free(c->chebuf);
+    c->chebuf = NULL;
+    return;
+  }
+  if (c->accumulated + n > c->checap) {
+    size_t cap = c->checap ? c->checap : RELAY_SIZE;
+    while (cap < c->accumulated + n) {
+      cap *= 2;
+    }
+    c->checap = cap > MAX_OBJECT_SIZE ? MAX_OBJECT_SIZE : cap;
+    c->chebuf = Realloc(c->chebuf, c->checap);
+  }
+  memcpy(c->chebuf + c->accumulated, buf, n);
+  c->accumulated += n;
+  if (c->admit < 0 && (c->admit = fresh_admit(c->chebuf, c->accumulated, c->auth, MAX_OBJECT_SIZE)) == 0) {
+    c->is_cacheable = 0;
+    free(c->chebuf);
+    c->chebuf = NULL;
+  }
+}
+
+/* 원 서버 -> 클라이언트. 클라이언트가 못 받으면 서버 읽기를 멈춘다 (backpressure) */
+static void on_server_read(loop_t *lp, conn *c) {
+  for (int i = 0; i < RELAY_BURST; i++) {
+    ssize_t n = read(c->serverfd, c->out, RELAY_SIZE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return;
+    }
+    if (n <= 0) {
+      // 응답 끝 (EOF). 본문이 끝까지 왔고 캐시 가능하면 넣고 끝 (상태 코드와 Cache-Control은 fresh.c가 봄)
+      time_t expires, now = time(NULL);
+      if (n == 0 && c->is_cacheable && c->accumulated > 0 && fresh_complete(c->chebuf, c->accumulated) &&
+          fresh_storable(c->chebuf, c->accumulated, c->auth, now, &expires) != FRESH_NOSTORE) {
+        cache_store(c->uri, c->chebuf, c->accumulated, 0, expires, fresh_grace(c->chebuf, c->accumulated));
+      }
+      conn_close(lp, c);
+      return;
+    }
+    accumulate(c, c->out, n);
+    c->outlen = n;
+    c->outoff = 0;
+
+    int rc = flush_client(c);
+    if (rc < 0) {
+      conn_close(lp, c);
+      return;
+    }
+    if (rc == 0) {
+      watch(lp, c, 1, 0);
+      watch(lp, c, 0, EPOLLOUT);
+      return;
+    }
+  }
+}
+
+static void on_client_write(loop_t *lp, conn *c) {
+  int rc = flush_client(c);
+  if (rc < 0) {
+    conn_close(lp, c);
+    return;
+  }
+  if (rc == 0) {
+    return;
+  }
+  if (c->state == ST_SERVE) {
+    conn_close(lp, c);
+    return;
+  }
+  // 중계 버퍼 비었으니 다시 서버에서 읽기
+  watch(lp, c, 0, 0);
+  watch(lp, c, 1, EPOLLIN);
+}
+
+static void conn_open(loop_t *lp, int fd) {
+  conn *c = Calloc(1, sizeof(conn));
+  c->state = ST_READ_LINE;
+  c->clientfd = fd;
+  c->serverfd = -1;
+  c->cli_ep.c = c;
+  c->cli_ep.is_server = 0;
+  c->srv_ep.c = c;
+  c->srv_ep.is_server = 1;
+  c->incap = INBUF_INIT;
+  c->in = Malloc(c->incap);
+  watch(lp, c, 0, EPOLLIN);
+  timer_arm(lp, c);
+}
+
+/* fd는 바로 닫고, 메모리는 이번 묶음이 끝난 뒤에 푼다
+   (같은 묶음에 이 연결의 다른 쪽 fd 이벤트가 남아 있을 수 있음) */
+static void conn_close(loop_t *lp, conn *c) {
+  if (c->closed) {
+    return;
+  }
+  close_server(lp, c);
+  watch(lp, c, 0, 0);
+  timer_unlink(c);
+  close(c->clientfd);
+  c->closed = 1;
+  c->next_dead = lp->dead;
+  lp->dead = c;
+}
+
+static void conn_free(conn *c) {
+  free(c->addrs);
+  free(c->in);
+  free(c->uri);
+  free(c->req);
+  if (c->pin) {
+    cache_put(c->pin);
+  }
+  else {
+    free(c->out);
+  }
+  free(c->chebuf);
+  free(c);
+}
+
+static void on_accept(loop_t *lp) {
+  while (1) {
+    // accept4는 _GNU_SOURCE가 필요한데 csapp.h의 gai_error와 충돌해서 fcntl로 따로 켠다
+    int fd = accept(lp->listenfd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;   // EAGAIN (다른 루프가 가져갔거나 다 받음), EMFILE 등
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    conn_open(lp, fd);
+  }
+}
+
+/* 지금 쓰레드를 cpu 하나에 고정. cpu_set_t/pthread_setaffinity_np는 _GNU_SOURCE가 필요한데
+   csapp.h의 gai_error와 충돌해서 비트마스크를 직접 만들어 syscall로 부른다 */
+static void pin_cpu(int cpu) {
+  unsigned long mask[16];
+
+  memset(mask, 0, sizeof(mask));
+  if (cpu >= (int)(sizeof(mask) * 8)) {
+    return;
+  }
+  mask[cpu / (8 * sizeof(unsigned long))] |= 1UL << (cpu % (8 * sizeof(unsigned long)));
+  if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) < 0) {
+    fprintf(stderr, "pin_cpu(%d): %s\n", cpu, strerror(errno));
+  }
+}
+
+/* 기한이 지난 연결들. connect 중이면 502, 나머지는 그냥 닫는다 */
+static void timer_expire(loop_t *lp) {
+  long now = now_ms();
+  conn *c;
+
+  while ((c = lp->connecting.head) != NULL && c->deadline <= now) {
+    timer_unlink(c);
+    close_server(lp, c);
+    origin_unreachable(lp, c, "");
+    timer_arm(lp, c);
+  }
+  while ((c = lp->idle.head) != NULL && c->deadline <= now) {
+    conn_close(lp, c);
+  }
+}
+
+/* 제일 가까운 기한까지 남은 ms (epoll_wait timeout). 기한이 없으면 -1 */
+static int timer_next(loop_t *lp) {
+  long next = -1, left;
+
+  if (lp->connecting.head) {
+    next = lp->connecting.head->deadline;
+  }
+  if (lp->idle.head && (next < 0 || lp->idle.head->deadline < next)) {
+    next = lp->idle.head->deadline;
+  }
+  if (next < 0) {
+    return -1;
+  }
+  left = next - now_ms();
+  return left < 0 ? 0 : (int)left;
+}
+
+static void *loop_run(void *vargp) {
+  loop_t *lp = vargp;
+  struct epoll_event events[MAX_EVENTS];
+
+  if (lp->cpu >= 0) {
+    pin_cpu(lp->cpu);
+  }
+
+  while (1) {
+    int n = epoll_wait(lp->epfd, events, MAX_EVENTS, timer_next(lp));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      unix_error("epoll_wait error");
+    }
+    for (int i = 0; i < n; i++) {
+      endpoint *ep = events[i].data.ptr;
+      unsigned ev = events[i].events;
+
+      if (ep == &lp->listen_ep) {
+        on_accept(lp);
+        continue;
+      }
+      conn *c = ep->c;
+      // 에러/끊김도 읽기·쓰기 시도에서 알아서 걸리게 넘긴다
+      if (ev & (EPOLLERR | EPOLLHUP)) {
+        ev |= EPOLLIN | EPOLLOUT;
+      }
+      if (ep->is_server) {
+        if (!c->closed && (ev & EPOLLOUT) && (c->srv_events & EPOLLOUT)) {
+          on_server_write(lp, c);
+        }
+        if (!c->closed && (ev & EPOLLIN) && (c->srv_events & EPOLLIN)) {
+          on_server_read(lp, c);
+        }
+      }
+      else {
+        if (!c->closed && (ev & EPOLLIN) && (c->cli_events & EPOLLIN)) {
+          on_client_read(lp, c);
+        }
+        if (!c->closed && (ev & EPOLLOUT) && (c->cli_events & EPOLLOUT)) {
+          on_client_write(lp, c);
+        }
+      }
+      // 진행이 있었으니 유휴 기한을 미룬다 (connect 기한은 그대로)
+      if (!c->closed && c->state != ST_CONNECTING) {
+        timer_arm(lp, c);
+      }
+    }
+    timer_expire(lp);
+    while (lp->dead) {
+      conn *c = lp->dead;
+      lp->dead = c->next_dead;
+      conn_free(c);
+    }
+  }
+  return NULL;
+}
+
+static loop_t *loop_create(int listenfd, int cpu) {
+  loop_t *lp = Calloc(1, sizeof(loop_t));
+  struct epoll_event ev;
+
+  if ((lp->epfd = epoll_create1(0)) < 0) {
+    unix_error("epoll_create1 error");
+  }
+  lp->listenfd = listenfd;
+  lp->cpu = cpu;
+  // 같은 listenfd를 여러 루프가 볼 때 연결 하나에 루프 하나만 깨도록 EPOLLEXCLUSIVE
+  // (리스너를 루프마다 따로 열었으면 상관없음)
+  ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  ev.data.ptr = &lp->listen_ep;
+  if (epoll_ctl(lp->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+    unix_error("epoll_ctl error");
+  }
+  return lp;
+}
+
+/* 리스너를 non-blocking으로 */
+static int nonblock_listener(int listenfd) {
+  fcntl(listenfd, F_SETFL, fcntl(listenfd, F_GETFL) | O_NONBLOCK);
+  return listenfd;
+}
+
+/*
+ * 이벤트 루프 nloops개(0이면 코어 개수)를 돌린다. 돌아오지 않음
+ * reuseport가 0이면 모든 루프가 listenfd 하나를 나눠 쓰고,
+ * 1이면 루프마다 port에 SO_REUSEPORT 리스너를 열고 루프 i를 코어 i에 고정한다.
+ */
+void event_run(int listenfd, char *port, int nloops, int reuseport) {
+  int ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+  loop_t **loops;
+
+  if (ncpus <= 0) {
+    ncpus = 1;
+  }
+  if (nloops == 0) {
+    nloops = ncpus;
+  }
+
+  // 리스너는 여기서 다 열어서 포트 문제는 시작할 때 바로 드러나게 한다
+  loops = Calloc(nloops, sizeof(loop_t *));
+  for (int i = 0; i < nloops; i++) {
+    if (reuseport) {
+      loops[i] = loop_create(nonblock_listener(Open_listenfd_reuseport(port)), i % ncpus);
+    }
+    else {
+      loops[i] = loop_create(nonblock_listener(listenfd), -1);
+    }
+  }
+
+  for (int i = 1; i < nloops; i++) {
+    pthread_t tid;
+    Pthread_create(&tid, NULL, loop_run, loops[i]);
+  }
+  loop_run(loops[0]);
+}
@@ -0,0 +1,343 @@
+/*
+ * fresh.c - HTTP 캐시 신선도 (RFC 9111에서 공유 캐시에 필요한 만큼)
+ *
+ * 원 서버 응답을 저장하기 전에 헤더를 보고 저장해도 되는지, 언제까지 신선한지(expires)를 정한다.
+ *  - 저장 안 함 : Cache-Control no-store / private, 캐시하는 상태 코드(200 203 300 301 308)가 아님,
+ *    Vary가 있음 (키가 uri뿐이라 변형을 구별 못 함), Authorization을 실은 요청의 응답인데
+ *    public / s-maxage / must-revalidate가 없음 (RFC 9111 3.5)
+ *  - 수명 : s-maxage > max-age > Expires - Date. 셋 다 없으면 Last-Modified부터 지난 시간의 10%
+ *    (최대 하루), 그것도 없으면 기본값(-E). no-cache면 0 (쓸 때마다 재검증)
+ *  - 나이 : max(Age, 지금 - Date)만큼은 이미 지난 걸로 친다
+ * 만료된 항목은 저장해 둔 ETag / Last-Modified로 조건부 요청을 만들고(fresh_conditional),
+ * 304가 오면 본문을 다시 받지 않고 expires만 새로 정한다 (proxy.c)
+ *
+ * 만료 뒤 유예 시간(grace) 동안은 만료된 사본을 바로 보내고 재검증은 백그라운드에서 한다
+ * (stale-while-revalidate, RFC 5861). stale-while-revalidate=N이 있으면 N, 없으면 기본값(-G).
+ * must-revalidate, proxy-revalidate, no-cache면 유예 없음
+ *
+ * 404, 410은 음성 캐시 : 수명이 -N초를 넘지 않게 줄이고 유예 없이. 원 서버가 아파도 같은 uri의
+ * 없는 객체 요청이 계속 원 서버로 가지 않게 (-N 0이면 저장 안 함)
+ *
+ * 본문을 받기 전에 헤더만으로 넣을지 정한다(fresh_admit) : 상태 코드, no-store, Content-Length가
+ * 자리를 넘는지. 못 넣을 응답은 처음부터 모으지 않는다. 응답을 그대로 모으는 중계(uring, epoll)는
+ * 다 받은 뒤에 본문이 Content-Length / chunked 끝까지 왔는지도 본다(fresh_complete)
+ *
+ * 헤더 버퍼는 NUL로 안 끝나도 된다. 상태 줄 다음부터 빈 줄(또는 len)까지만 본다
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "fresh.h"
+
+#define FRESH_VALUE   1024             // 헤더 값 최대 길이
+#define HEURISTIC_MAX (24 * 60 * 60)   // Last-Modified로 추정하는 수명의 상한 (초)
+
+static long default_ttl;   // 수명 정보가 하나도 없는 응답의 수명 (초)
+static long default_grace; // stale-while-revalidate가 없는 응답의 유예 시간 (초)
+static long negative_ttl;  // 404, 410의 최대 수명 (초)
+
+void fresh_init(long ttl, long grace, long neg_ttl) {
+  default_ttl = ttl;
+  default_grace = grace;
+  negative_ttl = neg_ttl;
+}
+
+/* name 헤더 값을 val에 (앞뒤 공백, CRLF 뺌). 있으면 1, 없으면 0. 같은 이름이 여러 줄이면 첫 줄만 */
+static int header_value(char *resp, size_t len, const char *name, char *val, size_t cap) {
+  size_t nlen = strlen(name);
+  char *p = resp, *end = resp + len, *eol;
+
+  // 상태 줄은 건너뛴다
+  if ((eol = memchr(p, '\n', end - p)) == NULL) {
+    return 0;
+  }
+  for (p = eol + 1; p < end; p = eol + 1) {
+    eol = memchr(p, '\n', end - p);
+    char *le = eol ? eol : end;
+    if (le == p || (le == p + 1 && *p == '\r')) {
+      break;   // 빈 줄 : 헤더 끝
+    }
+    if (le - p > (long)nlen && p[nlen] == ':' && !strncasecmp(p, name, nlen)) {
+      char *v = p + nlen + 1;
+      while (v < le && (*v == ' ' || *v == '\t')) {
+        v++;
+      }
+      while (le > v && (le[-1] == '\r' || le[-1] == ' ' || le[-1] == '\t')) {
+        le--;
+      }
+      size_t n = (size_t)(le - v) < cap - 1 ? (size_t)(le - v) : cap - 1;
+      memcpy(val, v, n);
+      val[n] = '\0';
+      return 1;
+    }
+    if (!eol) {
+      break;
+    }
+  }
+  return 0;
+}
+
+/* HTTP 날짜 (IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"). 못 읽으면 -1 */
+static time_t parse_date(char *s) {
+  static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  struct tm tm;
+  char mon[4];
+  char *m;
+
+  memset(&tm, 0, sizeof(tm));
+  if (sscanf(s, "%*[^,], %d %3s %d %d:%d:%d", &tm.tm_mday, mon, &tm.tm_year,
+             &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+    return -1;
+  }
+  if (strlen(mon) != 3 || (m = strstr(months, mon)) == NULL || (m - months) % 3) {
+    return -1;
+  }
+  tm.tm_mon = (m - months) / 3;
+  tm.tm_year -= 1900;
+  return timegm(&tm);
+}
+
+/* 상태 줄의 상태 코드. 못 읽으면 0 */
+int fresh_status(char *resp, size_t len) {
+  char line[64];
+  int status = 0;
+  size_t n = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+
+  memcpy(line, resp, n);
+  line[n] = '\0';
+  sscanf(line, "HTTP/%*d.%*d %d", &status);
+  return status;
+}
+
+/*
+ * fresh_lifetime - 응답 헤더로 now 기준 만료 시각을 *expiresp에.
+ *     리턴값 : FRESH_NOSTORE, FRESH_HEURISTIC, FRESH_EXPLICIT. 상태 코드는 안 본다 (304의 헤더에도 씀)
+ */
+int fresh_lifetime(char *resp, size_t len, time_t now, time_t *expiresp) {
+  char val[FRESH_VALUE], *tok, *save;
+  long lifetime = -1, smaxage = -1, age = 0;
+  int no_cache = 0, kind = FRESH_EXPLICIT;
+  time_t date = -1, t;
+
+  if (header_value(resp, len, "Cache-Control", val, sizeof(val))) {
+    for (tok = strtok_r(val, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+      while (*tok == ' ' || *tok == '\t') {
+        tok++;
+      }
+      if (!strncasecmp(tok, "no-store", 8) || !strncasecmp(tok, "private", 7)) {
+        return FRESH_NOSTORE;
+      }
+      if (!strncasecmp(tok, "no-cache", 8)) {
+        no_cache = 1;
+      }
+      else if (!strncasecmp(tok, "s-maxage=", 9)) {
+        smaxage = atol(tok + 9);
+      }
+      else if (!strncasecmp(tok, "max-age=", 8)) {
+        lifetime = atol(tok + 8);
+      }
+    }
+  }
+  if (header_value(resp, len, "Date", val, sizeof(val))) {
+    date = parse_date(val);
+  }
+  if (date < 0 || date > now) {
+    date = now;
+  }
+  if (header_value(resp, len, "Age", val, sizeof(val))) {
+    age = atol(val);
+  }
+  if (now - date > age) {
+    age = now - date;
+  }
+
+  if (no_cache) {
+    lifetime = 0;
+  }
+  else if (smaxage >= 0) {
+    lifetime = smaxage;
+  }
+  else if (lifetime < 0 && header_value(resp, len, "Expires", val, sizeof(val))) {
+    // 못 읽는 Expires("0" 등)는 이미 만료된 걸로
+    t = parse_date(val);
+    lifetime = t > date ? t - date : 0;
+  }
+  else if (lifetime < 0) {
+    kind = FRESH_HEURISTIC;
+    if (header_value(resp, len, "Last-Modified", val, sizeof(val)) &&
+        (t = parse_date(val)) >= 0 && t <= date) {
+      lifetime = (date - t) / 10 < HEURISTIC_MAX ? (date - t) / 10 : HEURISTIC_MAX;
+    }
+    else {
+      lifetime = default_ttl;
+    }
+  }
+  *expiresp = now + lifetime - age;
+  return kind;
+}
+
+/* 만료 뒤에 만료된 사본을 보내면서 백그라운드로 재검증해도 되는 시간 (초) */
+long fresh_grace(char *resp, size_t len) {
+  char val[FRESH_VALUE], *tok, *save;
+  long grace = default_grace;
+
+  // 에러 응답(음성 캐시)은 만료되면 바로 다시 가져온다
+  if (fresh_status(resp, len) >= 400) {
+    return 0;
+  }
+  if (header_value(resp, len, "Cache-Control", val, sizeof(val))) {
+    for (tok = strtok_r(val, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+      while (*tok == ' ' || *tok == '\t') {
+        tok++;
+      }
+      if (!strncasecmp(tok, "must-revalidate", 15) || !strncasecmp(tok, "proxy-revalidate", 16) ||
+          !strncasecmp(tok, "no-cache", 8)) {
+        return 0;
+      }
+      if (!strncasecmp(tok, "stale-while-revalidate=", 23)) {
+        grace = atol(tok + 23);
+      }
+    }
+  }
+  return grace;
+}
+
+/* Cache-Control에 지시자 name이 있는지 (name 또는 name=값) */
+static int cc_has(char *resp, size_t len, const char *name) {
+  char val[FRESH_VALUE], *tok, *save;
+  size_t n = strlen(name);
+
+  if (!header_value(resp, len, "Cache-Control", val, sizeof(val))) {
+    return 0;
+  }
+  for (tok = strtok_r(val, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    while (*tok == ' ' || *tok == '\t') {
+      tok++;
+    }
+    if (!strncasecmp(tok, name, n) && (tok[n] == '\0' || tok[n] == '=' || tok[n] == ' ')) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* 클라이언트 요청 헤더 줄들(요청 줄 없이, NUL로 끝남)에 Authorization이 있는지 */
+int fresh_authorized(char *hdrs) {
+  for (char *p = hdrs; *p; ) {
+    char *eol = strchr(p, '\n');
+    if (!strncasecmp(p, "Authorization:", 14)) {
+      return 1;
+    }
+    if (!eol) {
+      break;
+    }
+    p = eol + 1;
+  }
+  return 0;
+}
+
+/* 저장해도 되는 응답이면 fresh_lifetime 결과, 아니면 FRESH_NOSTORE.
+   auth는 Authorization을 실은 요청의 응답인지 (fresh_authorized) */
+int fresh_storable(char *resp, size_t len, int auth, time_t now, time_t *expiresp) {
+  char val[FRESH_VALUE];
+  int kind;
+
+  // 키는 uri뿐이라 요청 헤더에 따라 다른 응답(Vary)은 다른 클라이언트에게 엉뚱한 변형이 나간다
+  if (header_value(resp, len, "Vary", val, sizeof(val)) && val[0]) {
+    return FRESH_NOSTORE;
+  }
+  // 인증한 사용자의 응답은 원 서버가 공유해도 된다고 한 것만
+  if (auth && !cc_has(resp, len, "public") && !cc_has(resp, len, "s-maxage") &&
+      !cc_has(resp, len, "must-revalidate")) {
+    return FRESH_NOSTORE;
+  }
+  switch (fresh_status(resp, len)) {
+  case 200: case 203: case 300: case 301: case 308:
+    return fresh_lifetime(resp, len, now, expiresp);
+  case 404: case 410:
+    // 음성 캐시 : 명시한 수명이 있어도 -N초까지만
+    if (negative_ttl <= 0 || (kind = fresh_lifetime(resp, len, now, expiresp)) == FRESH_NOSTORE) {
+      return FRESH_NOSTORE;
+    }
+    if (kind == FRESH_HEURISTIC || *expiresp > now + negative_ttl) {
+      *expiresp = now + negative_ttl;
+    }
+    return kind;
+  default:
+    return FRESH_NOSTORE;
+  }
+}
+
+/* 저장된 응답의 검증자로 조건부 요청 헤더 줄들을 buf에. 쓴 바이트 수, 검증자가 없으면 0 */
+int fresh_conditional(char *resp, size_t len, char *buf, size_t cap) {
+  char val[FRESH_VALUE];
+  int n = 0, m;
+
+  if (header_value(resp, len, "ETag", val, sizeof(val)) &&
+      (m = snprintf(buf + n, cap - n, "If-None-Match: %s\r\n", val)) < (int)(cap - n)) {
+    n += m;
+  }
+  if (header_value(resp, len, "Last-Modified", val, sizeof(val)) &&
+      (m = snprintf(buf + n, cap - n, "If-Modified-Since: %s\r\n", val)) < (int)(cap - n)) {
+    n += m;
+  }
+  return n;
+}
+
+/* 빈 줄까지의 헤더 길이. len 안에 빈 줄이 없으면 0 */
+static size_t header_end(char *resp, size_t len) {
+  for (char *p = resp, *end = resp + len; p < end; ) {
+    char *eol = memchr(p, '\n', end - p);
+    if (!eol) {
+      break;
+    }
+    if (eol == p || (eol == p + 1 && *p == '\r')) {
+      return eol + 1 - resp;
+    }
+    p = eol + 1;
+  }
+  return 0;
+}
+
+/*
+ * fresh_admit - 원 서버 응답의 앞 len 바이트만 보고 캐시에 넣을 수 있을지 정한다.
+ *     리턴값 : 1(넣을 수 있음, 본문은 끝까지 받아 봐야 앎), 0(못 넣음 : fresh_storable이 거절,
+ *     Content-Length로 본 전체 크기가 cap을 넘음), -1(헤더가 아직 다 안 옴)
+ */
+int fresh_admit(char *resp, size_t len, int auth, size_t cap) {
+  char val[FRESH_VALUE];
+  size_t hdr_len = header_end(resp, len);
+  time_t expires;
+
+  if (hdr_len == 0) {
+    return len >= cap ? 0 : -1;
+  }
+  if (fresh_storable(resp, hdr_len, auth, time(NULL), &expires) == FRESH_NOSTORE) {
+    return 0;
+  }
+  if (header_value(resp, hdr_len, "Content-Length", val, sizeof(val)) && hdr_len + atol(val) > cap) {
+    return 0;
+  }
+  return 1;
+}
+
+/* 그대로 모은 응답(헤더 포함)이 끝까지 왔는지. Content-Length면 그 길이만큼, chunked면 마지막 0 청크와
+   빈 줄까지. 둘 다 없으면 EOF가 끝이니 1 */
+int fresh_complete(char *resp, size_t len) {
+  char val[FRESH_VALUE];
+  size_t hdr_len = header_end(resp, len);
+
+  if (hdr_len == 0) {
+    return 0;
+  }
+  // chunked는 늘 마지막 코딩이다 ("gzip, chunked")
+  if (header_value(resp, hdr_len, "Transfer-Encoding", val, sizeof(val)) &&
+      strlen(val) >= 7 && !strcasecmp(val + strlen(val) - 7, "chunked")) {
+    return len - hdr_len >= 5 && !memcmp(resp + len - 5, "0\r\n\r\n", 5);
+  }
+  if (header_value(resp, hdr_len, "Content-Length", val, sizeof(val))) {
+    return len - hdr_len == (size_t)atol(val);
+  }
+  return 1;
+}
@@ -0,0 +1,25 @@
+/*
+ * fresh.h - 응답 헤더로 캐시 신선도(freshness)를 정한다 (Cache-Control, Expires, ETag, Last-Modified)
+ */
+#ifndef __FRESH_H__
+#define __FRESH_H__
+
+#include <stddef.h>
+#include <time.h>
+
+#define FRESH_NOSTORE   -1   // 저장하면 안 됨 (no-store, private, Vary, 공개 안 한 인증 요청의 응답,
+                             // 캐시 안 하는 상태 코드, -N 0일 때 404 / 410)
+#define FRESH_HEURISTIC  0   // 명시가 없어서 Last-Modified나 기본값(-E)으로 정함
+#define FRESH_EXPLICIT   1   // s-maxage, max-age, Expires
+
+void fresh_init(long default_ttl, long default_grace, long neg_ttl);
+int fresh_status(char *resp, size_t len);
+int fresh_lifetime(char *resp, size_t len, time_t now, time_t *expiresp);
+int fresh_authorized(char *hdrs);
+int fresh_storable(char *resp, size_t len, int auth, time_t now, time_t *expiresp);
+long fresh_grace(char *resp, size_t len);
+int fresh_conditional(char *resp, size_t len, char *buf, size_t cap);
+int fresh_admit(char *resp, size_t len, int auth, size_t cap);
+int fresh_complete(char *resp, size_t len);
+
+#endif /* __FRESH_H__ */
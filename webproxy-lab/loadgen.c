@@ -0,0 +1,254 @@
+/*
+ * loadgen.c - 프록시 벤치마크용 부하 생성기
+ *
+ * 쓰레드 c개가 정해진 시간 동안 프록시에 GET 요청을 계속 보내고
+ * 초당 처리한 요청 수(requests/sec)와 평균 지연시간을 출력한다.
+ * -k면 HTTP/1.1 keep-alive로 연결 하나에 요청을 계속 보낸다 (Content-Length로 응답 경계를 앎)
+ * -z n이면 url 뒤에 k=0..n-1 쿼리를 Zipf(0.99) 분포로 붙여서 객체 n개를 섞어 요청한다
+ * (캐시 교체 정책의 적중률 비교용. 원 서버가 쿼리를 무시하고 같은 파일을 줘야 함)
+ *
+ * usage: loadgen [-c conns] [-d secs] [-k] [-z keys] <proxy_host> <proxy_port> <url>
+ */
+#include "csapp.h"
+#include <math.h>
+#include <stdint.h>
+
+static char *g_host, *g_port, *g_url;
+static int g_secs = 5;
+static int g_keepalive = 0;
+static int g_keys = 0;          // -z : 0이면 url 하나만
+static double *g_zipf_cdf;      // 키 i까지의 누적 확률
+static struct timeval g_deadline;
+
+typedef struct {
+  long requests;    // 끝까지 받은 요청 수
+  long errors;      // 연결 실패, 응답 없음
+  long bytes;       // 받은 바이트 합
+  double lat_sum;   // 지연시간 합 (ms)
+} stat_t;
+
+static double now_ms(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int expired(void) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return timercmp(&tv, &g_deadline, >=);
+}
+
+/* 요청 하나 : 연결 -> GET 전송 -> EOF까지 읽기. 받은 바이트 수, 실패하면 -1 */
+static long one_request(char *req, size_t reqlen) {
+  char buf[MAXBUF];
+  long total = 0;
+  ssize_t n;
+
+  int fd = open_clientfd(g_host, g_port);
+  if (fd < 0) {
+    return -1;
+  }
+  if (rio_writen(fd, req, reqlen) != (ssize_t)reqlen) {
+    close(fd);
+    return -1;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0) {
+    total += n;
+  }
+  close(fd);
+  return (n < 0 || total == 0) ? -1 : total;
+}
+
+/* keep-alive 연결에서 요청 하나 : GET 전송 -> 헤더 -> Content-Length만큼 본문.
+   받은 바이트 수, 실패하면 -1. 서버가 연결을 닫겠다고 하면 *closep = 1 */
+static long one_keepalive_request(int fd, rio_t *rp, char *req, size_t reqlen, int *closep) {
+  char line[MAXLINE], buf[MAXBUF];
+  long total = 0, body = -1;
+  ssize_t n;
+
+  if (rio_writen(fd, req, reqlen) != (ssize_t)reqlen) {
+    return -1;
+  }
+  while ((n = rio_readlineb(rp, line, sizeof(line))) > 0) {
+    total += n;
+    if (!strcmp(line, "\r\n")) {
+      break;
+    }
+    if (!strncasecmp(line, "Content-Length:", 15)) {
+      body = strtol(line + 15, NULL, 10);
+    }
+    if (!strncasecmp(line, "Connection:", 11) && strstr(line, "close")) {
+      *closep = 1;
+    }
+  }
+  // 길이를 모르면 EOF까지 읽고 닫는다
+  if (n <= 0 || body < 0) {
+    *closep = 1;
+  }
+  while (n > 0 && body != 0) {
+    size_t want = (body < 0 || body > (long)sizeof(buf)) ? sizeof(buf) : body;
+    if ((n = rio_readnb(rp, buf, want)) <= 0) {
+      break;
+    }
+    total += n;
+    if (body > 0) {
+      body -= n;
+    }
+  }
+  return (n < 0 || body > 0 || total == 0) ? -1 : total;
+}
+
+/* Zipf(0.99) 누적 분포를 미리 계산해 둔다 */
+static void zipf_init(int n) {
+  double sum = 0;
+
+  g_zipf_cdf = Calloc(n, sizeof(double));
+  for (int i = 0; i < n; i++) {
+    sum += 1.0 / pow(i + 1, 0.99);
+    g_zipf_cdf[i] = sum;
+  }
+  for (int i = 0; i < n; i++) {
+    g_zipf_cdf[i] /= sum;
+  }
+}
+
+/* 누적 분포에서 이분 탐색으로 키 하나 */
+static int zipf_key(unsigned *seed) {
+  double u = rand_r(seed) / ((double)RAND_MAX + 1);
+  int lo = 0, hi = g_keys - 1;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (g_zipf_cdf[mid] > u) {
+      hi = mid;
+    }
+    else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+static int build_get(char *req, size_t cap, unsigned *seed) {
+  char url[MAXLINE];
+
+  if (g_keys > 0) {
+    snprintf(url, sizeof(url), "%s%ck=%d", g_url, strchr(g_url, '?') ? '&' : '?', zipf_key(seed));
+  }
+  else {
+    snprintf(url, sizeof(url), "%s", g_url);
+  }
+  if (g_keepalive) {
+    return snprintf(req, cap, "GET %s HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", url);
+  }
+  return snprintf(req, cap, "GET %s HTTP/1.0\r\n\r\n", url);
+}
+
+static void *client(void *vargp) {
+  stat_t *st = vargp;
+  char req[MAXLINE];
+  int n, fd = -1, closing = 0;
+  unsigned seed = (unsigned)(uintptr_t)st ^ (unsigned)time(NULL);
+  rio_t rio;
+
+  n = build_get(req, sizeof(req), &seed);
+
+  while (!expired()) {
+    double start = now_ms();
+    long got;
+    if (g_keys > 0) {
+      n = build_get(req, sizeof(req), &seed);
+    }
+    if (!g_keepalive) {
+      got = one_request(req, n);
+    }
+    else {
+      if (fd < 0 && (fd = open_clientfd(g_host, g_port)) >= 0) {
+        rio_readinitb(&rio, fd);
+      }
+      got = fd < 0 ? -1 : one_keepalive_request(fd, &rio, req, n, &closing);
+      if (fd >= 0 && (got < 0 || closing)) {
+        close(fd);
+        fd = -1;
+        closing = 0;
+      }
+    }
+    if (got < 0) {
+      st->errors++;
+      continue;
+    }
+    st->requests++;
+    st->bytes += got;
+    st->lat_sum += now_ms() - start;
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int conns = 8, opt;
+
+  while ((opt = getopt(argc, argv, "c:d:kz:")) != -1) {
+    switch (opt) {
+    case 'c':
+      conns = atoi(optarg);
+      break;
+    case 'd':
+      g_secs = atoi(optarg);
+      break;
+    case 'k':
+      g_keepalive = 1;
+      break;
+    case 'z':
+      g_keys = atoi(optarg);
+      break;
+    default:
+      goto usage;
+    }
+  }
+  if (optind != argc - 3 || conns <= 0 || g_secs <= 0 || g_keys < 0) {
+    goto usage;
+  }
+  g_host = argv[optind];
+  g_port = argv[optind + 1];
+  g_url = argv[optind + 2];
+  if (g_keys > 0) {
+    zipf_init(g_keys);
+  }
+  Signal(SIGPIPE, SIG_IGN);
+
+  pthread_t *tids = Calloc(conns, sizeof(pthread_t));
+  stat_t *stats = Calloc(conns, sizeof(stat_t));
+  gettimeofday(&g_deadline, NULL);
+  g_deadline.tv_sec += g_secs;
+
+  double start = now_ms();
+  for (int i = 0; i < conns; i++) {
+    Pthread_create(&tids[i], NULL, client, &stats[i]);
+  }
+  stat_t sum = {0};
+  for (int i = 0; i < conns; i++) {
+    Pthread_join(tids[i], NULL);
+    sum.requests += stats[i].requests;
+    sum.errors += stats[i].errors;
+    sum.bytes += stats[i].bytes;
+    sum.lat_sum += stats[i].lat_sum;
+  }
+  double elapsed = (now_ms() - start) / 1000.0;
+
+  printf("conns=%d secs=%.2f requests=%ld errors=%ld req/s=%.1f MB/s=%.2f avg_ms=%.3f\n",
+         conns, elapsed, sum.requests, sum.errors, sum.requests / elapsed,
+         sum.bytes / elapsed / (1024 * 1024),
+         sum.requests ? sum.lat_sum / sum.requests : 0.0);
+  Free(tids);
+  Free(stats);
+  return 0;
+
+usage:
+  fprintf(stderr, "usage: %s [-c conns] [-d secs] [-k] [-z keys] <proxy_host> <proxy_port> <url>\n",
+          argv[0]);
+  exit(1);
+}
@@ -0,0 +1,511 @@
+/*
+ * policy.c - 캐시 교체 정책들
+ *
+ *  - lru     : 리스트 하나. 적중하면 머리로
+ *  - clock   : 리스트 하나 + 참조 비트. 내보낼 때 비트가 선 항목은 지우고 머리로 (second chance)
+ *  - tinylfu : W-TinyLFU. 작은 LRU 창(예산의 1%) 뒤에 SLRU 본 영역(probation / protected 80%).
+ *              창에서 밀려난 후보는 count-min sketch로 잰 빈도가 본 영역 희생자보다 높을 때만 들어감
+ *  - arc     : ARC. 한 번 본 것(T1) / 두 번 이상 본 것(T2)과 각각의 유령 리스트(B1, B2).
+ *              유령에 적중하면 T1 목표 크기 p를 그쪽으로 옮긴다
+ *  - s3fifo  : S3-FIFO. 작은 FIFO(10%) + 본 FIFO + 유령. 작은 FIFO에서 다시 안 읽힌 건 바로 나가고,
+ *              적중은 빈도(0~3)만 올린다
+ *
+ * 크기는 전부 바이트로 잰다 (항목 개수가 아니라 e->size 합). 유령은 항목 없이 해시와 크기만 기억한다.
+ * 상태(리스트, 유령, sketch)는 policy_state 하나에 모여 있고 캐시 샤드마다 따로 가진다
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "policy.h"
+
+#define NQUEUE 3
+
+/* ---------- 리스트 ---------- */
+
+typedef struct {
+  cache_entry *head, *tail;   // 머리가 최근에 들어온 / 쓴 쪽
+  size_t bytes;
+} plist;
+
+/* ---------- 유령 리스트 : 내보낸 항목의 (해시, 크기)만 FIFO로 기억 ---------- */
+
+typedef struct {
+  uint64_t hash;
+  unsigned seq;     // 같은 해시가 다시 들어오면 옛 기록은 seq가 안 맞아서 무시됨
+  unsigned size;
+} grec;
+
+typedef struct {
+  grec *ring;       // 들어온 순서
+  size_t cap, head, n;
+  grec *set;        // 해시 -> 기록 (open addressing, hash 0 빈 슬롯, 1 tombstone)
+  size_t scap, sused;
+  size_t bytes, limit;
+  unsigned seq;
+} ghost;
+
+static void ghost_init(ghost *g, size_t budget, size_t limit) {
+  size_t cap = budget / 256 > 64 ? budget / 256 : 64;
+  size_t scap = 1;
+
+  while (scap < cap * 4) {
+    scap <<= 1;
+  }
+  g->ring = Calloc(cap, sizeof(grec));
+  g->cap = cap;
+  g->set = Calloc(scap, sizeof(grec));
+  g->scap = scap;
+  g->limit = limit;
+}
+
+static grec *ghost_find(ghost *g, uint64_t hash) {
+  for (size_t i = hash & (g->scap - 1); ; i = (i + 1) & (g->scap - 1)) {
+    if (g->set[i].hash == 0) {
+      return NULL;
+    }
+    if (g->set[i].hash == hash) {
+      return &g->set[i];
+    }
+  }
+}
+
+static void ghost_del(ghost *g, grec *s) {
+  g->bytes -= s->size;
+  s->hash = 1;
+}
+
+/* tombstone이 쌓이면 같은 크기로 다시 만든다. 살아 있는 기록은 ring 크기 이하라 늘 1/4 이하 */
+static void ghost_rehash(ghost *g) {
+  grec *old = g->set;
+
+  g->set = Calloc(g->scap, sizeof(grec));
+  g->sused = 0;
+  for (size_t i = 0; i < g->scap; i++) {
+    if (old[i].hash > 1) {
+      size_t j = old[i].hash & (g->scap - 1);
+      while (g->set[j].hash) {
+        j = (j + 1) & (g->scap - 1);
+      }
+      g->set[j] = old[i];
+      g->sused++;
+    }
+  }
+  Free(old);
+}
+
+/* 제일 오래된 기록을 버린다 */
+static void ghost_pop(ghost *g) {
+  grec *r = &g->ring[g->head];
+  grec *s = ghost_find(g, r->hash);
+
+  if (s && s->seq == r->seq) {
+    ghost_del(g, s);
+  }
+  g->head = (g->head + 1) % g->cap;
+  g->n--;
+}
+
+static void ghost_add(ghost *g, cache_entry *e) {
+  grec *s = ghost_find(g, e->hash);
+  grec r = { e->hash, ++g->seq, e->size };
+
+  if (s) {
+    ghost_del(g, s);
+  }
+  if (g->n == g->cap) {
+    ghost_pop(g);
+  }
+  g->ring[(g->head + g->n++) % g->cap] = r;
+  if ((g->sused + 1) * 4 > g->scap * 3) {
+    ghost_rehash(g);
+  }
+  size_t i = r.hash & (g->scap - 1);
+  while (g->set[i].hash > 1) {
+    i = (i + 1) & (g->scap - 1);
+  }
+  if (g->set[i].hash == 0) {
+    g->sused++;
+  }
+  g->set[i] = r;
+  g->bytes += r.size;
+  while (g->bytes > g->limit && g->n > 0) {
+    ghost_pop(g);
+  }
+}
+
+/* 유령에 있으면 지우고 1 */
+static int ghost_take(ghost *g, uint64_t hash) {
+  grec *s = ghost_find(g, hash);
+
+  if (!s) {
+    return 0;
+  }
+  ghost_del(g, s);
+  return 1;
+}
+
+/* ---------- count-min sketch (4줄, 4비트까지 세는 8비트 카운터) ---------- */
+
+#define SK_ROWS 4
+#define SK_MAX  15
+
+typedef struct {
+  unsigned char *c;
+  size_t width;       // 줄마다 카운터 수 (2의 거듭제곱)
+  long samples, reset_at;
+} sketch;
+
+static const uint64_t sk_seed[SK_ROWS] = {
+  0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+};
+
+static void sketch_init(sketch *sk, size_t budget) {
+  size_t w = 256;
+
+  while (w < budget / 512) {
+    w <<= 1;
+  }
+  sk->c = Calloc(SK_ROWS * w, 1);
+  sk->width = w;
+  sk->samples = 0;
+  sk->reset_at = 10 * w;     // 이만큼 세면 전부 반으로 (오래된 인기는 잊음)
+}
+
+static unsigned char *sketch_cell(sketch *sk, int row, uint64_t hash) {
+  return &sk->c[row * sk->width + ((hash * sk_seed[row]) >> 32 & (sk->width - 1))];
+}
+
+static int sketch_est(sketch *sk, uint64_t hash) {
+  int min = SK_MAX;
+
+  for (int r = 0; r < SK_ROWS; r++) {
+    int v = *sketch_cell(sk, r, hash);
+    if (v < min) {
+      min = v;
+    }
+  }
+  return min;
+}
+
+static void sketch_add(sketch *sk, uint64_t hash) {
+  for (int r = 0; r < SK_ROWS; r++) {
+    unsigned char *c = sketch_cell(sk, r, hash);
+    if (*c < SK_MAX) {
+      (*c)++;
+    }
+  }
+  if (++sk->samples >= sk->reset_at) {
+    for (size_t i = 0; i < SK_ROWS * sk->width; i++) {
+      sk->c[i] >>= 1;
+    }
+    sk->samples /= 2;
+  }
+}
+
+/* ---------- 정책 상태 (캐시 샤드마다 하나)와 리스트 조작 ---------- */
+
+struct policy_state {
+  plist q[NQUEUE];    // 정책마다 쓰는 리스트 수가 다름 (아래 정책별 번호)
+  size_t budget;      // 이 상태가 관리하는 바이트 예산
+  ghost b1, b2;       // 유령. ARC는 둘, S3-FIFO는 b1만
+  sketch sk;          // W-TinyLFU 빈도
+  size_t arc_p;       // ARC의 T1 목표 바이트
+};
+
+static policy_state *state_new(size_t budget) {
+  policy_state *ps = Calloc(1, sizeof(policy_state));
+
+  ps->budget = budget;
+  return ps;
+}
+
+static void plist_push(policy_state *ps, int i, cache_entry *e) {
+  plist *l = &ps->q[i];
+
+  e->q = i;
+  e->prev = NULL;
+  e->next = l->head;
+  if (l->head) {
+    l->head->prev = e;
+  }
+  else {
+    l->tail = e;
+  }
+  l->head = e;
+  l->bytes += e->size;
+}
+
+static void plist_unlink(policy_state *ps, cache_entry *e) {
+  plist *l = &ps->q[e->q];
+
+  if (e->prev) {
+    e->prev->next = e->next;
+  }
+  else {
+    l->head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  }
+  else {
+    l->tail = e->prev;
+  }
+  l->bytes -= e->size;
+}
+
+/* 다른 리스트(또는 같은 리스트)의 머리로 */
+static void plist_move(policy_state *ps, cache_entry *e, int to) {
+  plist_unlink(ps, e);
+  plist_push(ps, to, e);
+}
+
+
+/* ---------- LRU ---------- */
+
+static void lru_hit(policy_state *ps, cache_entry *e) {
+  if (e != ps->q[0].head) {
+    plist_move(ps, e, 0);
+  }
+}
+
+static void lru_insert(policy_state *ps, cache_entry *e) {
+  plist_push(ps, 0, e);
+}
+
+static void any_remove(policy_state *ps, cache_entry *e, int evicted) {
+  plist_unlink(ps, e);
+}
+
+static cache_entry *lru_victim(policy_state *ps, uint64_t incoming) {
+  return ps->q[0].tail;
+}
+
+/* ---------- CLOCK ---------- */
+
+static void clock_hit(policy_state *ps, cache_entry *e) {
+  if (!__atomic_load_n(&e->freq, __ATOMIC_RELAXED)) {   // 이미 섰으면 캐시 라인을 안 건드림
+    __atomic_store_n(&e->freq, 1, __ATOMIC_RELAXED);
+  }
+}
+
+static void clock_insert(policy_state *ps, cache_entry *e) {
+  e->freq = 0;
+  plist_push(ps, 0, e);
+}
+
+static cache_entry *clock_victim(policy_state *ps, uint64_t incoming) {
+  cache_entry *e;
+
+  while ((e = ps->q[0].tail) != NULL && e->freq) {
+    e->freq = 0;
+    plist_move(ps, e, 0);
+  }
+  return e;
+}
+
+/* ---------- W-TinyLFU ---------- */
+
+#define TL_WINDOW    0
+#define TL_PROBATION 1
+#define TL_PROTECTED 2
+
+static policy_state *tinylfu_init(size_t b) {
+  policy_state *ps = state_new(b);
+
+  sketch_init(&ps->sk, b);
+  return ps;
+}
+
+static void tinylfu_access(policy_state *ps, uint64_t hash) {
+  sketch_add(&ps->sk, hash);
+}
+
+static void tinylfu_hit(policy_state *ps, cache_entry *e) {
+  size_t protect = (ps->budget - ps->budget / 100) * 8 / 10;    // 본 영역의 80%
+
+  if (e->q == TL_PROBATION) {
+    // 본 영역에서 다시 읽히면 protected로. 넘치면 protected의 꼬리를 probation으로 내림
+    plist_move(ps, e, TL_PROTECTED);
+    while (ps->q[TL_PROTECTED].bytes > protect && ps->q[TL_PROTECTED].tail != e) {
+      plist_move(ps, ps->q[TL_PROTECTED].tail, TL_PROBATION);
+    }
+  }
+  else if (e != ps->q[e->q].head) {
+    plist_move(ps, e, e->q);
+  }
+}
+
+static void tinylfu_insert(policy_state *ps, cache_entry *e) {
+  plist_push(ps, TL_WINDOW, e);
+}
+
+static cache_entry *tinylfu_victim(policy_state *ps, uint64_t incoming) {
+  size_t window = ps->budget / 100;
+
+  while (ps->q[TL_WINDOW].tail && ps->q[TL_WINDOW].bytes > window) {
+    // 창에서 밀려나는 후보와 본 영역의 희생자 중 빈도가 낮은 쪽을 내보낸다
+    cache_entry *cand = ps->q[TL_WINDOW].tail;
+    cache_entry *v = ps->q[TL_PROBATION].tail ? ps->q[TL_PROBATION].tail : ps->q[TL_PROTECTED].tail;
+    if (!v || ps->q[TL_PROBATION].bytes + ps->q[TL_PROTECTED].bytes + cand->size <= ps->budget - window) {
+      plist_move(ps, cand, TL_PROBATION);     // 본 영역에 자리가 있으면 그냥 들어감
+      continue;
+    }
+    if (sketch_est(&ps->sk, cand->hash) > sketch_est(&ps->sk, v->hash)) {
+      plist_move(ps, cand, TL_PROBATION);
+      return v;
+    }
+    return cand;
+  }
+  if (ps->q[TL_PROBATION].tail) {
+    return ps->q[TL_PROBATION].tail;
+  }
+  return ps->q[TL_PROTECTED].tail ? ps->q[TL_PROTECTED].tail : ps->q[TL_WINDOW].tail;
+}
+
+/* ---------- ARC ---------- */
+
+#define ARC_T1 0
+#define ARC_T2 1
+
+static policy_state *arc_init(size_t b) {
+  policy_state *ps = state_new(b);
+
+  ghost_init(&ps->b1, b, b);
+  ghost_init(&ps->b2, b, b);
+  return ps;
+}
+
+static void arc_hit(policy_state *ps, cache_entry *e) {
+  if (e != ps->q[ARC_T2].head) {
+    plist_move(ps, e, ARC_T2);
+  }
+}
+
+static void arc_insert(policy_state *ps, cache_entry *e) {
+  size_t d;
+
+  if (ghost_find(&ps->b1, e->hash)) {
+    // T1을 너무 일찍 비웠다 : p를 키운다
+    d = ps->b1.bytes >= ps->b2.bytes ? e->size : e->size * (ps->b2.bytes / ps->b1.bytes);
+    ps->arc_p = ps->arc_p + d < ps->budget ? ps->arc_p + d : ps->budget;
+    ghost_take(&ps->b1, e->hash);
+    plist_push(ps, ARC_T2, e);
+  }
+  else if (ghost_find(&ps->b2, e->hash)) {
+    // T2를 너무 일찍 비웠다 : p를 줄인다
+    d = ps->b2.bytes >= ps->b1.bytes ? e->size : e->size * (ps->b1.bytes / ps->b2.bytes);
+    ps->arc_p = ps->arc_p > d ? ps->arc_p - d : 0;
+    ghost_take(&ps->b2, e->hash);
+    plist_push(ps, ARC_T2, e);
+  }
+  else {
+    plist_push(ps, ARC_T1, e);
+  }
+  // |T1| + |B1| <= c, 전체 <= 2c
+  while (ps->b1.n > 0 && ps->q[ARC_T1].bytes + ps->b1.bytes > ps->budget) {
+    ghost_pop(&ps->b1);
+  }
+  while (ps->b2.n > 0 && ps->q[ARC_T1].bytes + ps->q[ARC_T2].bytes + ps->b1.bytes + ps->b2.bytes > 2 * ps->budget) {
+    ghost_pop(&ps->b2);
+  }
+}
+
+static void arc_remove(policy_state *ps, cache_entry *e, int evicted) {
+  plist_unlink(ps, e);
+  if (evicted) {
+    ghost_add(e->q == ARC_T1 ? &ps->b1 : &ps->b2, e);
+  }
+}
+
+static cache_entry *arc_victim(policy_state *ps, uint64_t incoming) {
+  cache_entry *t1 = ps->q[ARC_T1].tail, *t2 = ps->q[ARC_T2].tail;
+
+  if (t1 && (!t2 || ps->q[ARC_T1].bytes > ps->arc_p ||
+             (ps->q[ARC_T1].bytes == ps->arc_p && ghost_find(&ps->b2, incoming)))) {
+    return t1;
+  }
+  return t2;
+}
+
+/* ---------- S3-FIFO ---------- */
+
+#define S3_SMALL 0
+#define S3_MAIN  1
+#define S3_FREQ_MAX 3
+
+static policy_state *s3fifo_init(size_t b) {
+  policy_state *ps = state_new(b);
+
+  ghost_init(&ps->b1, b, b - b / 10);
+  return ps;
+}
+
+static void s3fifo_hit(policy_state *ps, cache_entry *e) {
+  unsigned char f = __atomic_load_n(&e->freq, __ATOMIC_RELAXED);
+
+  if (f < S3_FREQ_MAX) {
+    __atomic_store_n(&e->freq, f + 1, __ATOMIC_RELAXED);    // 동시 적중끼리 하나 잃어도 상관없음
+  }
+}
+
+static void s3fifo_insert(policy_state *ps, cache_entry *e) {
+  e->freq = 0;
+  plist_push(ps, ghost_take(&ps->b1, e->hash) ? S3_MAIN : S3_SMALL, e);
+}
+
+static void s3fifo_remove(policy_state *ps, cache_entry *e, int evicted) {
+  plist_unlink(ps, e);
+  if (evicted && e->q == S3_SMALL) {
+    ghost_add(&ps->b1, e);
+  }
+}
+
+static cache_entry *s3fifo_victim(policy_state *ps, uint64_t incoming) {
+  cache_entry *e;
+
+  while (1) {
+    if (ps->q[S3_SMALL].tail && (ps->q[S3_SMALL].bytes > ps->budget / 10 || !ps->q[S3_MAIN].tail)) {
+      // 작은 FIFO : 들어온 뒤로 한 번이라도 읽혔으면 본 FIFO로, 아니면 내보냄
+      e = ps->q[S3_SMALL].tail;
+      if (!e->freq) {
+        return e;
+      }
+      e->freq = 0;
+      plist_move(ps, e, S3_MAIN);
+    }
+    else if ((e = ps->q[S3_MAIN].tail) != NULL) {
+      // 본 FIFO : 빈도가 남아 있으면 하나 깎고 다시 머리로
+      if (!e->freq) {
+        return e;
+      }
+      e->freq--;
+      plist_move(ps, e, S3_MAIN);
+    }
+    else {
+      return NULL;
+    }
+  }
+}
+
+static const cache_policy policies[] = {
+  [POLICY_LRU]     = { "lru", 0, state_new, NULL, lru_hit, lru_insert, any_remove, lru_victim },
+  [POLICY_CLOCK]   = { "clock", 1, state_new, NULL, clock_hit, clock_insert, any_remove, clock_victim },
+  [POLICY_TINYLFU] = { "tinylfu", 0, tinylfu_init, tinylfu_access, tinylfu_hit, tinylfu_insert, any_remove,
+                       tinylfu_victim },
+  [POLICY_ARC]     = { "arc", 0, arc_init, NULL, arc_hit, arc_insert, arc_remove, arc_victim },
+  [POLICY_S3FIFO]  = { "s3fifo", 1, s3fifo_init, NULL, s3fifo_hit, s3fifo_insert, s3fifo_remove,
+                       s3fifo_victim },
+};
+
+const cache_policy *policy_get(int id) {
+  return &policies[id];
+}
+
+/* -p 이름으로 정책 번호. 없으면 -1 */
+int policy_find(const char *name) {
+  for (int i = 0; i < (int)(sizeof(policies) / sizeof(policies[0])); i++) {
+    if (!strcmp(policies[i].name, name)) {
+      return i;
+    }
+  }
+  return -1;
+}
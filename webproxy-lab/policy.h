@@ -0,0 +1,30 @@
+/*
+ * policy.h - 캐시 교체 정책 인터페이스 (-p)
+ */
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include "cache.h"
+
+// 정책의 리스트, 유령 등 (policy.c). 캐시 샤드마다 하나
+typedef struct policy_state policy_state;
+
+/*
+ * 정책은 항목에 박힌 prev/next/q/freq만 가지고 자기 리스트를 관리한다.
+ * 전부 그 상태를 가진 샤드의 락 안에서 불린다. hit만 shared_hit인 정책이면 읽기 락이라 atomic 연산만 해야 함
+ */
+typedef struct {
+  const char *name;
+  int shared_hit;                             // 1이면 hit가 항목의 freq만 atomic으로 고침
+  policy_state *(*init)(size_t budget);
+  void (*access)(policy_state *ps, uint64_t hash);   // 조회할 때마다 (적중이든 미스든). NULL이면 안 부름
+  void (*hit)(policy_state *ps, cache_entry *e);
+  void (*insert)(policy_state *ps, cache_entry *e);
+  void (*remove)(policy_state *ps, cache_entry *e, int evicted);  // 캐시에서 빠짐. evicted면 자리가 없어서
+  cache_entry *(*victim)(policy_state *ps, uint64_t incoming);  // 다음에 내보낼 항목 (빼지는 않음). 비었으면 NULL
+} cache_policy;
+
+const cache_policy *policy_get(int id);
+int policy_find(const char *name);
+
+#endif /* __POLICY_H__ */
@@ -1,68 +1,263 @@
 #include <stdio.h>
 #include "csapp.h"
-
-/* Recommended max cache and object sizes */
-#define CACHE_SET_SIZE 10
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
+#include "sbuf.h"
+#include "proxy.h"
+#include "uring.h"
+#include "zerocopy.h"
+#include "upstream.h"
+#include "dnscache.h"
+#include "cache.h"
+#include "slab.h"
+#include "policy.h"
+#include "fresh.h"
+#include "disk.h"
+#include "snap.h"
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
     "Firefox/10.0.3\r\n";
 
-    // 캐시 블록
+conf g_conf = { MODE_POOL, DEFAULT_NTHREADS, DEFAULT_SBUFSIZE, 0, 0, 1,
+                 DEFAULT_KA_IDLE, DEFAULT_KA_MAX, DEFAULT_UP_MAX, DEFAULT_UP_IDLE,
+                 DEFAULT_DNS_TTL, DEFAULT_CONNECT_MS, MAX_CACHE_SIZE,
+                 POLICY_LRU, DEFAULT_CACHE_SHARDS, DEFAULT_CACHE_TTL,
+                 DEFAULT_CACHE_GRACE, NULL, DEFAULT_DISK_BYTES, NULL,
+                 DEFAULT_SNAP_SECS, DEFAULT_NEG_TTL };
+
+// 원 서버 응답 헤더에서 뽑은 것
 typedef struct {
-  char uri[MAXLINE];
-  char data[MAX_OBJECT_SIZE]; // 캐시에 들어있는 데이터
-  size_t size;     // 실제 데이터의 사이즈
-  int valid;    // 이 블록을 사용하고 있는지 아닌지 (0이면 사용 가능, 1이면 사용 불가능)
-  int last_use; // LRU를 이용해서 교체해주기 위해서 마지막 사용일자 저장
-} cache_block;
-
-// 캐시 집합체
+  int status;             // 상태 코드 (못 읽으면 0)
+  long content_length;    // Content-Length (없으면 -1)
+  size_t hdr_len;         // 상태 줄 + 헤더 + 빈 줄 바이트 수
+  int chunked;            // Transfer-Encoding: chunked
+  int complete;           // 빈 줄까지 다 읽었는지 (EOF로 끝났으면 0)
+  int server_close;       // 원 서버가 응답 뒤에 연결을 닫는지 (HTTP/1.0 기본, Connection: close)
+} resp_info;
+
+// 응답을 클라이언트로 넘기면서 캐시할 사본을 모으는 상태
 typedef struct {
-  size_t current_size;      // 지금 캐시 블록이 사용하고 있는 캐시 블록들의 size의 합 (MAX_CACHE_SIZE를 벗어나면 안됨.)
-  cache_block blocks[CACHE_SET_SIZE];   // 배열을 이용해서 10개 정도 넣어 놓기
-  int cache_use_index;    // 비교해서 가장 작은 놈이 교체하는 것. 사용할 때마다 증가하는 것 (0부터 시작)
-  pthread_mutex_t cache_m;      // 뮤덱스
-} cache;
-
-// 전역 캐시
-static cache g_cache;
-
-void cache_insert(char *uri, char *chebuf, size_t total_size);
-void cache_LRU_delete(int min_LRU_idx);
-int cache_hit(char *uri, int clientfd);
-void doit(int fd);
+  int fd;                 // 클라이언트
+  char *chebuf;           // MAX_OBJECT_SIZE
+  ssize_t accumulated;    // chebuf에 모은 바이트 수
+  int is_cacheable;       // MAX_OBJECT_SIZE를 넘으면 0
+  flight *f;              // leader면 chebuf는 f->buf. 모을 때마다 붙은 쪽에 알린다
+  int client_gone;        // 클라이언트가 끊겼지만 붙은 쪽을 위해 원 서버 응답은 계속 받는 중
+  int spill;              // MAX_OBJECT_SIZE를 넘으면 디스크 캐시로 넘겨도 되는 응답
+  int on_disk;            // 넘겼음. 이후로는 dw에 쓴다
+  disk_writer dw;
+} relay_t;
+
+proxy_stats g_stats;
+
+// accept 루프(생산자)와 워커 쓰레드(소비자)가 공유하는 연결 큐
+static sbuf_t g_sbuf;
+
+// 백그라운드 재검증 작업 하나 (stale-while-revalidate). 요청을 다시 만들 재료와 잡아 둔 만료 항목
+typedef struct refresh_job {
+  char key[MAXLINE], host[MAXLINE], path[MAXLINE], port[16];
+  char raw_header[MAXLINE * 4];
+  cache_entry *stale;         // 끝나면 refreshing을 내리고 cache_put
+  struct refresh_job *next;
+} refresh_job;
+
+// 재검증 작업 큐 (요청 쓰레드 -> refresher 쓰레드)
+static struct {
+  refresh_job *head, *tail;
+  int len;
+  pthread_mutex_t m;
+  pthread_cond_t cv;
+} g_refresh = { NULL, NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+// uring 모드에서 워커마다 하나씩 가지는 링 (NULL이면 rio로 I/O)
+static __thread uring_t *t_ring;
+
+int cache_hit(char *uri, int clientfd, int *keepp, cache_entry **stalep);
+static int serve_entry(cache_entry *e, int clientfd, int *keepp);
+static int serve_disk(char *key, int clientfd, int *keepp);
+static void strip_conditionals(char *raw_header);
+void serve_client(int fd);
+int doit(rio_t *rio, int fd, int allow_keep);
+static int fetch(int fd, char *key, char *host, char *path, char *port, char *raw_header, int keep,
+                 flight *f, cache_entry *stale);
+static int flight_follow(flight *f, int fd, int *keepp);
+static void origin_unreachable(int fd, char *key, char *host);
+static int negative_entry(cache_entry *e);
+static ssize_t send_iov(int fd, struct iovec *iov, int iovcnt);
+static int wait_request(rio_t *rp, int fd);
+static int client_keepalive(char *version, char *raw_header);
+static int has_token(char *val, char *tok);
+static int send_response_header(int fd, char *hdr, resp_info *ri, int keep);
+static int relay_out(relay_t *rl, char *buf, size_t n);
+static int relay_body(rio_t *srio, relay_t *rl, long remaining);
+static int relay_chunked(rio_t *srio, relay_t *rl);
+static ssize_t writev_all(int fd, struct iovec *iov, int iovcnt);
 void read_requesthdrs(rio_t *rp);
 int read_header_until_blank(rio_t *rp, char *raw_header, size_t rawcap, char *host_hdr, size_t hostcap);
-void parse_uri(char *uri, char *host, char *path, char *port, char *host_hdr);
-void Rebuild_request(char *host, char *path, char *port, char *raw_header, char *host_hdr, int serverfd);
+int read_response_header(rio_t *rp, char *hdr, size_t cap, resp_info *ri);
 void clienterror(int fd, char *filename, char *errnum, char *shortmsg, char *longmsg);
 void *thread(void *vargp);
-void init_cache();
+void *worker(void *vargp);
+static void *refresher(void *vargp);
+static int refresh_submit(char *key, char *host, char *path, char *port, char *raw_header, cache_entry *stale);
+void usage(char *prog);
+void print_stats(int sig);
 
 int main(int argc, char **argv)
 { 
-  init_cache();     // 캐시 초기화 하기
   Signal(SIGPIPE, SIG_IGN);
-  int listenfd, connfd;
+  Signal(SIGUSR1, print_stats);
+  int listenfd, connfd, opt;
   char hostname[MAXLINE], port[MAXLINE];
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
 
-  if(argc != 2) {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
-    exit(1);
+  while ((opt = getopt(argc, argv, "m:n:q:l:RSk:K:u:U:D:T:c:p:s:E:G:N:d:B:f:F:")) != -1) {
+    switch (opt) {
+    case 'm':
+      if (!strcmp(optarg, "thread"))
+        g_conf.mode = MODE_THREAD;
+      else if (!strcmp(optarg, "pool"))
+        g_conf.mode = MODE_POOL;
+      else if (!strcmp(optarg, "epoll"))
+        g_conf.mode = MODE_EPOLL;
+      else if (!strcmp(optarg, "uring"))
+        g_conf.mode = MODE_URING;
+      else
+        usage(argv[0]);
+      break;
+    case 'l':
+      g_conf.nloops = atoi(optarg);
+      break;
+    case 'R':
+      g_conf.reuseport = 1;
+      break;
+    case 'S':
+      g_conf.splice = 0;
+      break;
+    case 'k':
+      g_conf.ka_idle = atoi(optarg);
+      break;
+    case 'K':
+      g_conf.ka_max = atoi(optarg);
+      break;
+    case 'u':
+      g_conf.up_max = atoi(optarg);
+      break;
+    case 'U':
+      g_conf.up_idle = atoi(optarg);
+      break;
+    case 'D':
+      g_conf.dns_ttl = atoi(optarg);
+      break;
+    case 'T':
+      g_conf.connect_ms = atoi(optarg);
+      break;
+    case 'c':
+      g_conf.cache_bytes = atol(optarg);
+      break;
+    case 'p':
+      if ((g_conf.cache_policy = policy_find(optarg)) < 0)
+        usage(argv[0]);
+      break;
+    case 's':
+      g_conf.cache_shards = atoi(optarg);
+      break;
+    case 'E':
+      g_conf.cache_ttl = atol(optarg);
+      break;
+    case 'G':
+      g_conf.cache_grace = atol(optarg);
+      break;
+    case 'N':
+      g_conf.neg_ttl = atol(optarg);
+      break;
+    case 'd':
+      g_conf.spool_dir = optarg;
+      break;
+    case 'B':
+      g_conf.disk_bytes = atol(optarg);
+      break;
+    case 'f':
+      g_conf.snap_path = optarg;
+      break;
+    case 'F':
+      g_conf.snap_secs = atoi(optarg);
+      break;
+    case 'n':
+      g_conf.nthreads = atoi(optarg);
+      break;
+    case 'q':
+      g_conf.sbufsize = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || g_conf.nthreads <= 0 || g_conf.sbufsize <= 0 || g_conf.nloops < 0 ||
+      g_conf.ka_idle < 0 || g_conf.ka_max <= 0 || g_conf.up_max < 0 || g_conf.up_idle <= 0 ||
+      g_conf.dns_ttl < 0 || g_conf.connect_ms <= 0 || g_conf.cache_bytes < 0 ||
+      g_conf.cache_shards <= 0 || g_conf.cache_ttl < 0 || g_conf.cache_grace < 0 || g_conf.neg_ttl < 0 ||
+      g_conf.disk_bytes <= 0 || g_conf.snap_secs < 0 ||
+      (g_conf.reuseport && g_conf.mode != MODE_EPOLL)) {
+    usage(argv[0]);
+  }
+  cache_init(g_conf.cache_bytes, g_conf.cache_policy, g_conf.cache_shards);     // 캐시 초기화 하기
+  fresh_init(g_conf.cache_ttl, g_conf.cache_grace, g_conf.neg_ttl);
+  // 스냅샷을 올리고 저장 쓰레드를 띄운다. SIGINT / SIGTERM을 막은 마스크가 이후 쓰레드에 물려지니 제일 먼저
+  if (g_conf.snap_path) {
+    snap_start(g_conf.snap_path, g_conf.snap_secs);
+  }
+  // 디스크 캐시는 쓰레드 쪽 중계 경로만 채운다 (epoll, uring 중계는 안 씀)
+  if (g_conf.spool_dir && g_conf.mode != MODE_EPOLL) {
+    disk_init(g_conf.spool_dir, g_conf.disk_bytes);
+  }
+  upstream_init(g_conf.up_max, g_conf.up_idle);
+  dns_init(g_conf.dns_ttl);
+
+  // epoll 모드는 이벤트 루프들이 accept까지 다 한다 (돌아오지 않음)
+  // -R이면 리스너도 루프마다 따로 연다
+  if (g_conf.mode == MODE_EPOLL) {
+    event_run(g_conf.reuseport ? -1 : Open_listenfd(argv[optind]), argv[optind],
+              g_conf.nloops, g_conf.reuseport);
+  }
+
+  listenfd = Open_listenfd(argv[optind]);
+
+  // 만료된 항목의 백그라운드 재검증 (epoll 모드는 안 씀)
+  for (int i = 0; i < REFRESH_THREADS; i++) {
+    pthread_t tid;
+    Pthread_create(&tid, NULL, refresher, NULL);
+  }
+
+  // 풀 모드면 워커를 미리 만들어 둔다
+  if (g_conf.mode == MODE_POOL || g_conf.mode == MODE_URING) {
+    sbuf_init(&g_sbuf, g_conf.sbufsize);
+    for (int i = 0; i < g_conf.nthreads; i++) {
+      pthread_t tid;
+      Pthread_create(&tid, NULL, worker, NULL);
+    }
+  }
+  // uring 모드는 multishot accept로 받아서 큐에 넣는다 (돌아오지 않음)
+  if (g_conf.mode == MODE_URING) {
+    uring_accept_loop(listenfd, &g_sbuf);
   }
 
-  listenfd = Open_listenfd(argv[1]);
   while(1) {
     clientlen = sizeof(clientaddr);
     connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen);
     Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0);
     printf("Accepted connection from (%s %s)\n", hostname, port);
+
+    if (g_conf.mode == MODE_POOL) {
+      // 큐에 넣기만 하면 놀고 있는 워커가 가져감
+      sbuf_insert(&g_sbuf, connfd);
+      continue;
+    }
     // 쓰레드 힙메모리에 저장해서
     int *connfdp = malloc(sizeof(int));
     *connfdp = connfd;
@@ -72,84 +267,572 @@ int main(int argc, char **argv)
   }
 }
 
-void doit(int fd) {
+void usage(char *prog) {
+  fprintf(stderr, "usage: %s [-m thread|pool|epoll|uring] [-n nthreads] [-q queue] [-l loops [-R]] [-S]\n"
+                  "       [-k idle_secs] [-K max_requests] [-u upstream_idle] [-U upstream_secs]\n"
+                  "       [-D dns_ttl] [-T connect_ms] [-c cache_bytes]\n"
+                  "       [-p lru|clock|tinylfu|arc|s3fifo] [-s cache_shards] [-E default_ttl]\n"
+                  "       [-G grace_secs] [-N negative_ttl] [-d spool_dir [-B disk_bytes]]\n"
+                  "       [-f snapshot [-F snap_secs]] <port>\n"
+                  "  -d: only thread/pool fill the disk cache, uring only serves from it and epoll\n"
+                  "      ignores it; expired disk entries are refetched, not revalidated\n", prog);
+  exit(1);
+}
+
+/* 클라이언트 연결 하나를 끝날 때까지 처리한다.
+   keep-alive면 요청을 여러 개 받는데, 다음 요청은 ka_idle초까지만 기다리고 ka_max개까지만 받는다 */
+void serve_client(int fd) {
+  rio_t rio;
+  int one = 1;
+
+  // 응답을 헤더 / 본문으로 나눠 쓰니까 Nagle을 끈다. 안 그러면 keep-alive에서
+  // 다음 요청이 상대의 delayed ACK(~40ms)만큼 늦어진다
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  Rio_readinitb(&rio, fd);
+  for (int n = 1; doit(&rio, fd, g_conf.ka_idle > 0 && n < g_conf.ka_max); n++) {
+    if (!wait_request(&rio, fd)) {
+      break;
+    }
+  }
+}
+
+/* 다음 요청이 올 때까지 ka_idle초 기다린다. 1(읽을 게 있음), 0(타임아웃, 에러)
+   파이프라이닝으로 rio 버퍼에 이미 들어와 있으면 바로 1 */
+static int wait_request(rio_t *rp, int fd) {
+  struct pollfd pfd = { fd, POLLIN, 0 };
+  int rc;
+
+  if (rp->rio_cnt > 0) {
+    return 1;
+  }
+  while ((rc = poll(&pfd, 1, g_conf.ka_idle * 1000)) < 0 && errno == EINTR)
+    ;
+  return rc > 0;
+}
+
+/* 요청 하나를 처리한다. allow_keep이 0이면 무조건 이번 응답으로 끝낸다.
+   리턴값 : 1(연결을 유지해서 다음 요청을 받음), 0(닫아야 함) */
+int doit(rio_t *rio, int fd, int allow_keep) {
   char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
   char host[MAXLINE], path[MAXLINE], port[16] = "80";
-  rio_t rio;
 
   // 1단계 : 라인 요청
-  Rio_readinitb(&rio, fd);
-  // 파일을 열었는데 한 줄도 없으면 종료
-  if (Rio_readlineb(&rio, buf, MAXLINE) <= 0) {
-    return;
+  // 연결이 끊겼거나 한 줄도 없으면 종료
+  if (rio_readlineb(rio, buf, MAXLINE) <= 0) {
+    return 0;
   }
   printf("Request headers:\n");
   printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version);
+  STAT_INC(requests);
+  method[0] = uri[0] = version[0] = '\0';
+  int nfield = sscanf(buf, "%s %s %s", method, uri, version);
   // method는 get만 허용
   if (strcasecmp(method, "GET")) {
     clienterror(fd, method, "501", "Not implemented", "Server does not implement this method.");
-    return;
+    return 0;
+  }
+  // uri가 없는 요청 줄은 400 (epoll 엔진의 start_request와 같음)
+  if (nfield < 2) {
+    clienterror(fd, method, "400", "Bad Request", "Malformed request line");
+    return 0;
   }
 
   // 2단계 : 헤더를 빈 줄 끝까지 읽기
   char raw_header[MAXLINE * 4];   // 헤더 원본
   char host_hdr[MAXLINE];     // 호스트 안전하게 ",,,\r\n"까지 저장
-  if (read_header_until_blank(&rio, raw_header, sizeof(raw_header), host_hdr, sizeof(host_hdr)) < 0) {
-    return ;
+  if (read_header_until_blank(rio, raw_header, sizeof(raw_header), host_hdr, sizeof(host_hdr)) < 0) {
+    return 0;
   }
+  int keep = allow_keep && client_keepalive(version, raw_header);
 
-  // 3단계 : parse_uri
+  // 3단계 : parse_uri. 캐시는 uri 원문이 아니라 정규화한 키로 찾고 넣는다
+  char key[MAXLINE];
   parse_uri(uri, host, path, port, host_hdr);
+  // "http:///"처럼 host가 빈 요청은 원 서버에 가 보지도 않는다 (빈 host 키로 음성 캐시가 생기면 안 됨)
+  if (host[0] == '\0') {
+    clienterror(fd, uri, "400", "Bad Request", "No host in request");
+    return 0;
+  }
+  cache_key(key, sizeof(key), host, port, path);
 
   // 캐시에 들어 있는지 검사 들어있으면 1을 반환하고 없으면 0을 반환
-  if (cache_hit(uri, fd)) {
-    return;
+  // 만료된 항목이 있으면 stale로 잡아 두고 그걸로 재검증한다
+  cache_entry *stale = NULL;
+  int hit = cache_hit(key, fd, &keep, &stale);
+  // 만료됐어도 유예 시간 안이면 만료된 사본을 바로 보내고 재검증은 refresher 쓰레드에 맡긴다
+  // (stale-while-revalidate). 항목마다 재검증은 하나만
+  if (stale && time(NULL) < __atomic_load_n(&stale->expires, __ATOMIC_RELAXED) + stale->grace) {
+    STAT_INC(stale_served);
+    hit = serve_entry(stale, fd, &keep);
+    if (!__atomic_exchange_n(&stale->refreshing, 1, __ATOMIC_ACQ_REL)) {
+      if (refresh_submit(key, host, path, port, raw_header, stale) == 0) {
+        stale = NULL;   // 잡은 참조는 작업이 가져감
+      }
+      else {
+        __atomic_store_n(&stale->refreshing, 0, __ATOMIC_RELEASE);
+      }
+    }
+  }
+  // 같은 uri를 다른 쓰레드가 이미 원 서버에서 가져오는 중이면 거기 붙어서 받는 대로 따라 보낸다 (single-flight)
+  // 아무것도 못 보내고 끝나면(캐시 못 하는 응답, 에러) 각자 가져온다
+  flight *f = NULL;
+  int lead = 0;
+  if (!hit) {
+    f = cache_flight_begin(key, &lead);
+    if (!lead) {
+      hit = flight_follow(f, fd, &keep);
+      cache_flight_leave(f);
+      f = NULL;
+      // leader가 디스크 캐시(큰 객체)나 음성 캐시(원 서버 실패)에 넣었을 수 있다
+      if (!hit) {
+        cache_entry *again = NULL;
+        hit = cache_hit(key, fd, &keep, stale ? &again : &stale);
+        if (again) {
+          cache_put(again);
+        }
+      }
+    }
+  }
+  int rc = hit ? hit > 0 && keep : fetch(fd, key, host, path, port, raw_header, keep, f, stale);
+  if (f) {
+    cache_flight_end(f);
+  }
+  if (stale) {
+    cache_put(stale);
   }
+  return rc;
+}
+
+/* 다른 쓰레드가 채우는 flight를 따라가며 클라이언트로 보낸다.
+   리턴값 : 1(다 보냄), 0(아무것도 못 보냄, 직접 가져와야 함), -1(보내다 에러나 중간에 끊김) */
+static int flight_follow(flight *f, int fd, int *keepp) {
+  size_t sent = 0, filled;
+  struct iovec iov[3];
+  int state;
+
+  while ((state = cache_flight_wait(f, sent, &filled)) != FLIGHT_FAIL) {
+    int iovcnt = 0;
+    ssize_t total = 0;
+    // 처음에는 헤더. cache_hit처럼 빈 줄 앞에 Connection 헤더를 끼운다
+    // 원 서버 응답 그대로(hdr_len 0)이거나 길이로 끝을 모르는 응답이면 연결을 유지하지 않는다
+    if (sent == 0) {
+      if (f->hdr_len == 0 || !f->framed) {
+        *keepp = 0;
+      }
+      if (f->hdr_len > 0) {
+        char *conn = *keepp ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+        iov[iovcnt++] = (struct iovec){ f->buf, f->hdr_len - 2 };
+        iov[iovcnt++] = (struct iovec){ conn, strlen(conn) };
+        sent = f->hdr_len;
+      }
+    }
+    iov[iovcnt++] = (struct iovec){ f->buf + sent, filled - sent };
+    for (int i = 0; i < iovcnt; i++) {
+      total += iov[i].iov_len;
+    }
+    if (send_iov(fd, iov, iovcnt) != total) {
+      return -1;
+    }
+    sent = filled;
+    if (state == FLIGHT_DONE) {
+      return 1;
+    }
+  }
+  return sent == 0 ? 0 : -1;
+}
+
+static int fetch_into(int fd, char *key, char *host, char *path, char *port, char *raw_header, int keep,
+                      flight *f, cache_entry *stale, char *chebuf, char *req);
+
+/* 캐시 미스 : 원 서버에서 받아서 클라이언트로 보내고 캐시할 수 있으면 key로 저장한다.
+   stale이 있으면 그 검증자로 조건부 요청을 보내서 304면 stale을 갱신해서 보낸다.
+   fd가 음수면 클라이언트 없이 캐시만 갱신한다 (백그라운드 재검증).
+   리턴값 : 1(클라이언트 연결을 유지), 0(닫아야 함) */
+static int fetch(int fd, char *key, char *host, char *path, char *port, char *raw_header, int keep,
+                 flight *f, cache_entry *stale) {
+  // 응답 사본(MAX_OBJECT_SIZE)과 요청 버퍼는 힙에 (워커 스택에 두기엔 크다).
+  // leader면 flight의 버퍼에 모아서 붙은 쪽이 같이 본다
+  char *own = f ? NULL : Malloc(MAX_OBJECT_SIZE);
+  char *req = Malloc(REQ_BUFSIZE);
+  int rc = fetch_into(fd, key, host, path, port, raw_header, keep, f, stale, f ? f->buf : own, req);
+
+  Free(req);
+  Free(own);
+  return rc;
+}
+
+static int fetch_into(int fd, char *key, char *host, char *path, char *port, char *raw_header, int keep,
+                      flight *f, cache_entry *stale, char *chebuf, char *req) {
   // 캐시 미스 발생
-  else {
-    // 요청을 재조립하고 원 서버에 전송을 하고 응답을 클라이언트하네 보내기
-    // 원 서버의 소켓 열기, 원 서버의 입장에서는 proxy가 클라이언트임
-    int serverfd = Open_clientfd(host, port);
+  // 요청을 재조립하고 원 서버에 전송을 하고 응답을 클라이언트하네 보내기
+  // 원 서버의 소켓 열기, 원 서버의 입장에서는 proxy가 클라이언트임
+  relay_t rl = { fd, chebuf, 0, 1, f, fd < 0 };
+  int serverfd, reused = 0;
+  int auth = fresh_authorized(raw_header);   // build_request가 raw_header를 자르기 전에
+  time_t now = time(NULL), expires;
+
+  // uring 모드 : 요청 전송과 중계를 링으로 (캐시 누적 규칙은 아래 rio 루프와 같음)
+  // 응답을 EOF까지 그대로 넘기니까 클라이언트/원 서버 연결 둘 다 유지하지 않는다
+  // (헤더를 안 고쳐서 hdr_len 0으로 저장)
+  // 재검증(stale)은 304를 가로채야 하니까 아래 rio 경로로 (조건부 요청, cache_refresh)
+  if (t_ring && !stale) {
+    if ((serverfd = dns_connect(host, port)) < 0) {
+      origin_unreachable(fd, key, host);
+      return 0;
+    }
+    int n = build_request(host, path, port, raw_header, req, 0);
+    rl.accumulated = uring_relay(t_ring, serverfd, fd, req, n, chebuf, MAX_OBJECT_SIZE, auth, &rl.is_cacheable, f);
+    if (rl.accumulated > 0 && rl.is_cacheable && fresh_complete(chebuf, rl.accumulated) &&
+        fresh_storable(chebuf, rl.accumulated, auth, now, &expires) != FRESH_NOSTORE) {
+      if (f) {
+        cache_flight_fill(f, rl.accumulated, FLIGHT_DONE);
+      }
+      cache_store(key, chebuf, rl.accumulated, 0, expires, fresh_grace(chebuf, rl.accumulated));
+    }
+    Close(serverfd);
+    return 0;
+  }
+
+  // 만료된 항목의 검증자(ETag, Last-Modified). 있으면 클라이언트의 조건(If-*)은 빼고 우리 것만 보낸다
+  // (원 서버의 304가 우리 항목 얘기여야 하니까)
+  char cond[MAXLINE];
+  int condlen = 0;
+  if (stale) {
+    condlen = fresh_conditional(stale->data, stale->hdr_len ? stale->hdr_len : stale->size, cond, sizeof(cond));
+  }
+  if (condlen > 0) {
+    strip_conditionals(raw_header);
+  }
+
+  // 요청 라인 재작성해서 서버에 보내기. 풀을 쓰면 원 서버에도 keep-alive를 요청한다
+  int reqlen = build_request(host, path, port, raw_header, req, g_conf.up_max > 0);
+  if (condlen > 0) {
+    reqlen -= 2;     // 빈 줄 앞에 끼운다
+    memcpy(req + reqlen, cond, condlen);
+    reqlen += condlen;
+    reqlen += sprintf(req + reqlen, "\r\n");
+  }
+  rio_t srio;
+  resp_info ri;
+  serverfd = upstream_get(host, port, &reused);
+  while (1) {
     if (serverfd < 0) {
-      clienterror(fd, host, "502", "Bad Gateway", "Failed to connect to origin");
-      return ;
+      origin_unreachable(fd, key, host);
+      return 0;
     }
-    // 요청 라인 재작성
-    Rebuild_request(host, path, port, raw_header, host_hdr, serverfd);
-    // 서버에 보내기
-    rio_t srio;
+    // 응답 헤더부터 읽어서 chebuf 앞에 쌓아 둔다 (Content-Length를 보려고)
     Rio_readinitb(&srio, serverfd);
-    char rbuf[MAXLINE];
-    char chebuf[MAX_OBJECT_SIZE];
-    ssize_t accumulated = 0;
-    ssize_t rn;
-    int is_cacheable = 1;
-
-    while ((rn = Rio_readnb(&srio, rbuf, sizeof(rbuf))) > 0) {
-      Rio_writen(fd, rbuf, rn);   // 서버에서 읽은 걸 클라이언트로!
-      // 캐시가 아직 가능하다는 것
-      if (is_cacheable) {
-        // 공간이 있으면
-        if (accumulated + rn <= MAX_OBJECT_SIZE) {
-          memcpy(chebuf + accumulated, rbuf, rn);
-          accumulated += rn;
-        }
-        // 공간이 없으면
-        else {
-          is_cacheable = 0;
-        }
-      }
+    if (rio_writen(serverfd, req, reqlen) == reqlen &&
+        read_response_header(&srio, chebuf, MAX_OBJECT_SIZE, &ri) == 0) {
+      break;
+    }
+    Close(serverfd);
+    // 풀에서 꺼낸 연결은 원 서버가 방금 닫았을 수 있다. 새 연결로 한 번만 다시
+    if (!reused) {
+      clienterror(fd, host, "502", "Bad Gateway", "Invalid response from origin");
+      return 0;
+    }
+    serverfd = dns_connect(host, port);
+    reused = 0;
+  }
+  if (reused) {
+    STAT_INC(upstream_reused);
+  }
+
+  // 304 : 가지고 있던 항목이 아직 맞다. 본문은 다시 안 받고 신선도만 새로 정해서 그걸 보낸다.
+  // 304에 수명 정보가 없으면 저장해 둔 헤더 기준으로 지금부터 다시 센다
+  if (condlen > 0 && ri.status == 304) {
+    int kind = fresh_lifetime(chebuf, ri.hdr_len, now, &expires);
+    if (kind == FRESH_HEURISTIC) {
+      kind = fresh_lifetime(stale->data, stale->hdr_len ? stale->hdr_len : stale->size, now, &expires);
+    }
+    cache_refresh(stale, kind == FRESH_NOSTORE ? now : expires);
+    STAT_INC(revalidated);
+    if (ri.complete && !ri.server_close && srio.rio_cnt == 0) {
+      upstream_put(host, port, serverfd);
+    }
+    else {
+      Close(serverfd);
+    }
+    if (f) {
+      memcpy(f->buf, stale->data, stale->size);
+      f->hdr_len = stale->hdr_len;
+      f->framed = stale->hdr_len > 0;
+      cache_flight_fill(f, stale->size, FLIGHT_DONE);
+    }
+    return fd >= 0 && serve_entry(stale, fd, &keep) > 0 && keep;
+  }
+  // 캐시에 넣을지는 본문을 받기 전에 헤더로 정한다 (상태 코드, Cache-Control, Content-Length).
+  // 못 넣을 응답은 chebuf에 한 바이트도 모으지 않는다
+  if (fresh_storable(chebuf, ri.hdr_len, auth, now, &expires) == FRESH_NOSTORE) {
+    rl.is_cacheable = 0;
+  }
+
+  // 본문 길이를 알아야 다음 요청이랑 경계를 정할 수 있다. EOF로만 끝나는 응답이면 닫는다
+  long body = ri.content_length;
+  if (ri.status / 100 == 1 || ri.status == 204 || ri.status == 304) {
+    body = 0;
+  }
+  int framed = ri.complete && (ri.chunked || body >= 0);
+  if (!framed) {
+    keep = 0;
+  }
+  // MAX_OBJECT_SIZE를 넘으면 디스크 캐시로 (끝까지 다 받았는지 알 수 있는 응답만)
+  rl.spill = rl.is_cacheable && framed && disk_enabled();
+  int too_big = !ri.chunked && body >= 0 && ri.hdr_len + body > MAX_OBJECT_SIZE;
+  if (too_big) {
+    rl.is_cacheable = 0;
+  }
+  // 길이가 정해져 있고 캐시에 들어갈 응답이면 붙은 쪽이 지금부터 따라 보낸다.
+  // 어디에도 못 넣을 응답이면 붙은 쪽은 지금 놓아 준다 (각자 가져감).
+  // 아니면 다 받을 때까지 기다리게 둔다 (chunked는 중간에 MAX_OBJECT_SIZE를 넘을 수 있으니까)
+  if (f) {
+    f->hdr_len = ri.hdr_len;
+    f->framed = framed;
+    if (rl.is_cacheable && framed && !ri.chunked) {
+      cache_flight_fill(f, ri.hdr_len, FLIGHT_STREAM);
+    }
+    else if (!rl.is_cacheable && !rl.spill) {
+      cache_flight_fill(f, 0, FLIGHT_FAIL);
+    }
+  }
+  rl.accumulated = ri.hdr_len;
+  if (!rl.client_gone && send_response_header(fd, chebuf, &ri, keep) < 0) {
+    // 붙은 쪽이 따라오는 중이면 클라이언트가 끊겨도 원 서버 응답은 끝까지 받는다
+    if (!f || f->state != FLIGHT_STREAM) {
+      Close(serverfd);
+      return 0;
+    }
+    rl.client_gone = 1;
+  }
+
+  // 길이만 봐도 MAX_OBJECT_SIZE를 넘는 응답은 메모리 캐시에 못 들어가니까 모을 필요도 없다.
+  // rio 버퍼에 이미 올라온 만큼만 쓰고 나머지는 splice로 커널 안에서 옮긴다.
+  // 디스크 캐시에 넣을 거면 헤더와 rio 버퍼 몫을 파일에 쓰고 나머지는 tee로 파일에도
+  int rc;
+  if (g_conf.splice && too_big) {
+    // 백그라운드 재검증인데 이제 메모리 캐시 못 하는 크기 : 받을 이유가 없다 (옛 항목은 유예가 끝나면 안 씀)
+    if (fd < 0) {
+      Close(serverfd);
+      return 0;
+    }
+    long n = srio.rio_cnt < body ? srio.rio_cnt : body;
+    rl.on_disk = rl.spill && disk_begin(&rl.dw) == 0;
+    // 디스크 파일을 못 열었으면 붙은 쪽도 놓아 준다. 넣으면 끝날 때 디스크에서 보낸다
+    if (f && !rl.on_disk) {
+      cache_flight_fill(f, 0, FLIGHT_FAIL);
     }
-    // 최종의 옵젝 값이 0보다 크거나 최대 사이즈 보다 작거나 같으면 캐시에 insert
-    if (is_cacheable && accumulated > 0) {
-      pthread_mutex_lock(&g_cache.cache_m);
-      // 캐시에 넣을 때 필요한 게 머가 있을까 데이터들이랑 또
-      cache_insert(uri, chebuf, accumulated);
-      pthread_mutex_unlock(&g_cache.cache_m);
+    if (rl.on_disk) {
+      int file_ok = disk_write(&rl.dw, chebuf, ri.hdr_len) == 0 &&
+                    disk_write(&rl.dw, srio.rio_bufptr, n) == 0 && rl.dw.written + body - n <= g_conf.disk_bytes;
+      rc = (rio_writen(fd, srio.rio_bufptr, n) == n &&
+            splice_tee(serverfd, fd, rl.dw.fd, body - n, &file_ok) == body - n) ? 0 : -1;
+      rl.dw.written += body - n;
+      rl.dw.failed |= !file_ok;
     }
+    else {
+      rc = (rio_writen(fd, srio.rio_bufptr, n) == n &&
+            splice_relay(serverfd, fd, body - n) == body - n) ? 0 : -1;
+    }
+    srio.rio_cnt -= n;
+    STAT_INC(spliced);
+  }
+  else {
+    // 디스크로 갈 게 길이로 보이면 chebuf를 거치지 않고 처음부터 파일에
+    if (too_big && rl.spill && disk_begin(&rl.dw) == 0) {
+      rl.on_disk = 1;
+      disk_write(&rl.dw, chebuf, ri.hdr_len);
+    }
+    else if (too_big && f) {
+      cache_flight_fill(f, 0, FLIGHT_FAIL);
+    }
+    rc = ri.chunked ? relay_chunked(&srio, &rl) : relay_body(&srio, &rl, body);
+    // 끝까지 다 받은 응답이고 최대 사이즈 보다 작거나 같으면 캐시에 insert
+    if (rc == 0 && rl.is_cacheable) {
+      if (f) {
+        cache_flight_fill(f, rl.accumulated, FLIGHT_DONE);
+      }
+      cache_store(key, chebuf, rl.accumulated, ri.hdr_len, expires, fresh_grace(chebuf, ri.hdr_len));
+      disk_remove(key);
+    }
+  }
+  // 디스크로 넘긴 응답 : 다 받았으면 색인에 올리고 메모리에 남은 옛 버전은 뺀다
+  if (rl.on_disk && rc == 0) {
+    disk_commit(&rl.dw, key, ri.hdr_len, expires);
+    cache_remove(key);
+  }
+  else if (rl.on_disk) {
+    disk_abort(&rl.dw);
+  }
+  // 응답 경계가 분명하고 딱 거기까지만 읽었으면 원 서버 연결은 다음 미스에 다시 쓴다
+  if (rc == 0 && framed && !ri.server_close && srio.rio_cnt == 0) {
+    upstream_put(host, port, serverfd);
+  }
+  else {
     Close(serverfd);
   }
+  return rc == 0 && keep && !rl.client_gone;
+}
+
+/* 원 서버에 못 붙음 (이름 해석이나 connect 실패). 502를 보내고 key로 -N초 캐시해 둔다 (음성 캐시).
+   그동안 같은 uri는 원 서버에 다시 붙어 보지 않고 메모리에서 502. 만료된 진짜 객체(2xx)가 있으면
+   그걸 502로 덮지 않고(cache_negative), 백그라운드 재검증(fd < 0)이면 보내지도 않는다 */
+static void origin_unreachable(int fd, char *key, char *host) {
+  char buf[MAXLINE * 2];
+  int n = format_error(buf, host, "502", "Bad Gateway", "Failed to connect to origin");
+
+  if (fd >= 0) {
+    rio_writen(fd, buf, n);
+    cache_negative(key, buf, n, g_conf.neg_ttl);
+  }
+}
+
+/* 음성 캐시 항목(원 서버 실패의 502, 404, 410)인지. 만료되면 재검증할 사본이 아니라 그냥 미스 */
+static int negative_entry(cache_entry *e) {
+  return fresh_status(e->data, e->size) >= 400;
+}
+
+/* 클라이언트가 연결 유지를 원하는지.
+   HTTP/1.1은 Connection: close가 없으면 유지, HTTP/1.0은 keep-alive를 보냈을 때만 */
+static int client_keepalive(char *version, char *raw_header) {
+  int keep = !strcasecmp(version, "HTTP/1.1");
+
+  for (char *line = raw_header; *line; ) {
+    char *next = strchr(line, '\n');
+    char *val = NULL;
+    if (!strncasecmp(line, "Connection:", 11)) {
+      val = line + 11;
+    }
+    else if (!strncasecmp(line, "Proxy-Connection:", 17)) {
+      val = line + 17;
+    }
+    if (val && has_token(val, "close")) {
+      return 0;
+    }
+    if (val && has_token(val, "keep-alive")) {
+      keep = 1;
+    }
+    if (!next) {
+      break;
+    }
+    line = next + 1;
+  }
+  return keep;
+}
+
+/* 헤더 값(줄 끝까지)에 tok이 들어 있는지 (대소문자 무시) */
+static int has_token(char *val, char *tok) {
+  size_t n = strlen(tok);
+
+  for (; *val && *val != '\r' && *val != '\n'; val++) {
+    if (!strncasecmp(val, tok, n)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* 응답 헤더를 클라이언트로. 빈 줄 앞에 우리 쪽 Connection 헤더를 끼워 넣는다.
+   (hop-by-hop 헤더는 read_response_header가 이미 뺐음) 리턴값 : 0(성공), -1(에러) */
+static int send_response_header(int fd, char *hdr, resp_info *ri, int keep) {
+  char *conn = keep ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+  // 빈 줄 없이 EOF로 끝난 헤더는 손대지 않고 그대로
+  if (!ri->complete) {
+    return rio_writen(fd, hdr, ri->hdr_len) == (ssize_t)ri->hdr_len ? 0 : -1;
+  }
+  if (rio_writen(fd, hdr, ri->hdr_len - 2) != (ssize_t)ri->hdr_len - 2 ||
+      rio_writen(fd, conn, strlen(conn)) != (ssize_t)strlen(conn)) {
+    return -1;
+  }
+  return 0;
+}
+
+/* 클라이언트로 보내고, 캐시할 수 있는 동안은 사본을 chebuf에 모은다.
+   리턴값 : 0(성공), -1(클라이언트 쪽 에러) */
+static int relay_out(relay_t *rl, char *buf, size_t n) {
+  if (rl->f) {
+    cache_flight_touch(rl->f);
+  }
+  // 캐시가 아직 가능하다는 것
+  if (rl->is_cacheable) {
+    // 공간이 있으면
+    if (rl->accumulated + n <= MAX_OBJECT_SIZE) {
+      memcpy(rl->chebuf + rl->accumulated, buf, n);
+      rl->accumulated += n;
+      // 붙은 쪽은 우리 클라이언트를 기다리지 않게 보내기 전에 알린다
+      if (rl->f && rl->f->state == FLIGHT_STREAM) {
+        cache_flight_fill(rl->f, rl->accumulated, FLIGHT_STREAM);
+      }
+    }
+    // 공간이 없으면. 디스크 캐시로 넘길 수 있으면 지금까지 모은 것부터 파일로
+    else {
+      rl->is_cacheable = 0;
+      if (rl->spill && disk_begin(&rl->dw) == 0) {
+        rl->on_disk = 1;
+        disk_write(&rl->dw, rl->chebuf, rl->accumulated);
+      }
+    }
+  }
+  if (rl->on_disk) {
+    disk_write(&rl->dw, buf, n);
+  }
+  if (!rl->client_gone && rio_writen(rl->fd, buf, n) != (ssize_t)n) {
+    if (!rl->f || rl->f->state != FLIGHT_STREAM) {
+      return -1;
+    }
+    rl->client_gone = 1;
+  }
+  return 0;
+}
+
+/* 본문 remaining 바이트를 중계한다. remaining이 음수면 서버가 닫을 때(EOF)까지.
+   리턴값 : 0(본문을 다 옮김), -1(에러, 본문 중간에 끊김) */
+static int relay_body(rio_t *srio, relay_t *rl, long remaining) {
+  char rbuf[MAXLINE];
+  ssize_t rn;
+
+  while (remaining != 0) {
+    size_t want = (remaining < 0 || remaining > (long)sizeof(rbuf)) ? sizeof(rbuf) : remaining;
+    if ((rn = rio_readnb(srio, rbuf, want)) <= 0) {
+      return (rn == 0 && remaining < 0) ? 0 : -1;
+    }
+    // 서버에서 읽은 걸 클라이언트로!
+    if (relay_out(rl, rbuf, rn) < 0) {
+      return -1;
+    }
+    if (remaining > 0) {
+      remaining -= rn;
+    }
+  }
+  return 0;
+}
+
+/* Transfer-Encoding: chunked 본문을 그대로 중계한다. 크기 줄 -> 데이터 + CRLF 반복,
+   크기 0인 청크 뒤에 trailer를 빈 줄까지. 리턴값 : 0(끝까지 옮김), -1(에러) */
+static int relay_chunked(rio_t *srio, relay_t *rl) {
+  char line[MAXLINE];
+  ssize_t n;
+
+  while (1) {
+    if ((n = rio_readlineb(srio, line, MAXLINE)) <= 0 || relay_out(rl, line, n) < 0) {
+      return -1;
+    }
+    long size = strtol(line, NULL, 16);
+    if (size <= 0) {
+      break;
+    }
+    if (relay_body(srio, rl, size + 2) < 0) {
+      return -1;
+    }
+  }
+  // trailer
+  do {
+    if ((n = rio_readlineb(srio, line, MAXLINE)) <= 0 || relay_out(rl, line, n) < 0) {
+      return -1;
+    }
+  } while (strcmp(line, "\r\n") && strcmp(line, "\n"));
+  return 0;
 }
 
 /* 요청 헤더를 \r\n(빈칸)까지 읽는다.
@@ -167,7 +850,7 @@ int read_header_until_blank(rio_t *rp, char *raw_header, size_t rawcap, char *ho
   }
 
   while (1) {
-    ssize_t n = Rio_readlineb(rp, line, MAXLINE);
+    ssize_t n = rio_readlineb(rp, line, MAXLINE);
     // 연결 끊김이나 오류
     if (n <= 0) {
       return -1;
@@ -176,17 +859,79 @@ int read_header_until_blank(rio_t *rp, char *raw_header, size_t rawcap, char *ho
     if (!strcmp(line, "\r\n")) {
       break;
     }
-    // host는 첫번쨰 라인만 저장
-    if(!strncasecmp(line, "Host:", 5) && host_hdr && hostcap > 0 && host_hdr[0] == '\0'){
-      snprintf(host_hdr, hostcap, "%s", line);
+    add_header_line(line, raw_header, rawcap, host_hdr, hostcap);
+  }
+  return 0;
+}
+
+/* 헤더 한 줄을 원문에 누적하고, Host: 라인이면 host_hdr에 따로 저장한다.
+   (rio로 읽든 epoll 버퍼에서 자르든 같은 규칙을 쓰려고 분리함) */
+int add_header_line(char *line, char *raw_header, size_t rawcap, char *host_hdr, size_t hostcap) {
+  // host는 첫번쨰 라인만 저장
+  if(!strncasecmp(line, "Host:", 5) && host_hdr && hostcap > 0 && host_hdr[0] == '\0'){
+    snprintf(host_hdr, hostcap, "%s", line);
+  }
+  // 원문 누적
+  if(raw_header && rawcap) {
+    size_t remain = rawcap - 1 - strlen(raw_header);
+    strncat(raw_header, line, remain);
+  }
+  return 0;
+}
+
+/* 원 서버 응답의 상태 줄과 헤더를 빈 줄까지 hdr(cap)에 읽고 ri를 채운다.
+   hop-by-hop 헤더(Connection, Keep-Alive, Proxy-Connection)는 빼고 모은다. 클라이언트 쪽
+   연결 헤더는 프록시가 정해서 붙임 (send_response_header). 빈 줄은 "\r\n"으로 맞춘다.
+   리턴값 : 0(성공), -1(아무것도 못 읽음, 헤더가 cap보다 큼)
+   빈 줄 전에 EOF면 읽은 데까지를 헤더로 친다 (complete = 0, 나머지 중계 루프가 EOF로 끝냄) */
+int read_response_header(rio_t *rp, char *hdr, size_t cap, resp_info *ri) {
+  ssize_t n;
+
+  ri->status = 0;
+  ri->content_length = -1;
+  ri->hdr_len = 0;
+  ri->chunked = 0;
+  ri->complete = 0;
+  ri->server_close = 1;
+
+  while ((n = rio_readlineb(rp, hdr + ri->hdr_len, cap - ri->hdr_len)) > 0) {
+    char *line = hdr + ri->hdr_len;
+    ri->hdr_len += n;
+    if (ri->hdr_len >= cap - 2) {
+      return -1;   // 줄이 잘렸거나 헤더가 너무 큼
     }
-    // 원문 누적
-    if(raw_header && rawcap) {
-      size_t remain = rawcap - 1 - strlen(raw_header);
-      strncat(raw_header, line, remain);
+    if (ri->status == 0) {
+      int minor = 0;
+      sscanf(line, "HTTP/%*d.%d %d", &minor, &ri->status);
+      ri->server_close = (minor == 0);
+      continue;
+    }
+    if (!strcmp(line, "\r\n") || !strcmp(line, "\n")) {
+      strcpy(line, "\r\n");
+      ri->hdr_len = line + 2 - hdr;
+      ri->complete = 1;
+      break;
+    }
+    if (!strncasecmp(line, "Content-Length:", 15)) {
+      ri->content_length = strtol(line + 15, NULL, 10);
+    }
+    else if (!strncasecmp(line, "Transfer-Encoding:", 18) && has_token(line + 18, "chunked")) {
+      ri->chunked = 1;
+    }
+    else if (!strncasecmp(line, "Connection:", 11) || !strncasecmp(line, "Keep-Alive:", 11) ||
+             !strncasecmp(line, "Proxy-Connection:", 17)) {
+      if (!strncasecmp(line, "Connection:", 11)) {
+        if (has_token(line + 11, "close")) {
+          ri->server_close = 1;
+        }
+        else if (has_token(line + 11, "keep-alive")) {
+          ri->server_close = 0;
+        }
+      }
+      ri->hdr_len -= n;
     }
   }
-  return 0;
+  return ri->hdr_len > 0 ? 0 : -1;
 }
 
 void parse_uri(char *uri, char *host, char *path, char *port, char *host_hdr) {
@@ -301,35 +1046,129 @@ void parse_uri(char *uri, char *host, char *path, char *port, char *host_hdr) {
   }
 }
 
+/*
+ * cache_key - parse_uri 결과로 캐시 키를 만든다. 같은 자원을 가리키는 표기는 같은 키가 되게 (RFC 3986 6.2.2)
+ *     "http://" + 소문자 호스트 + (80이 아니면 ":포트") + 경로.
+ *     %XX는 unreserved 문자면 풀고 나머지는 hex를 대문자로, 경로의 . 과 .. 세그먼트는 없앤다.
+ *     쿼리는 %XX만 맞추고 그대로 둔다. fragment는 버림
+ *     (원 서버에 보내는 요청은 손대지 않는다. 키로만 씀)
+ */
+void cache_key(char *key, size_t cap, char *host, char *port, char *path) {
+  char norm[MAXLINE], out[MAXLINE], hostl[MAXLINE], portpart[24] = "";
+  size_t n = 0, o = 0, plen, i;
+  char *end;
+
+  // percent-encoding 정리
+  for (char *p = path; *p && *p != '#' && n < sizeof(norm) - 3; p++) {
+    if (*p == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+      char hex[3] = { p[1], p[2], '\0' };
+      int c = strtol(hex, NULL, 16);
+      if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+        norm[n++] = c;
+      }
+      else {
+        norm[n++] = '%';
+        norm[n++] = toupper((unsigned char)p[1]);
+        norm[n++] = toupper((unsigned char)p[2]);
+      }
+      p += 2;
+    }
+    else {
+      norm[n++] = *p;
+    }
+  }
+  norm[n] = '\0';
+  end = strchr(norm, '?');
+  plen = end ? (size_t)(end - norm) : n;
+
+  // 경로의 . 과 .. 세그먼트 제거. 세그먼트마다 "/seg"로 붙이고 ..이면 마지막 하나를 뗀다
+  if (norm[0] != '/') {
+    memcpy(out, norm, plen);
+    o = plen;
+  }
+  for (i = 0; norm[0] == '/' && i < plen; ) {
+    size_t s = i + 1, e = s;
+    while (e < plen && norm[e] != '/') {
+      e++;
+    }
+    if (e - s == 1 && norm[s] == '.') {
+      // 그대로 둠
+    }
+    else if (e - s == 2 && norm[s] == '.' && norm[s + 1] == '.') {
+      while (o > 0 && out[o - 1] != '/') {
+        o--;
+      }
+      if (o > 0) {
+        o--;
+      }
+    }
+    else {
+      out[o++] = '/';
+      memcpy(out + o, norm + s, e - s);
+      o += e - s;
+      i = e;
+      continue;
+    }
+    // . 이나 ..으로 끝나면 디렉터리니까 / 하나 남긴다
+    if (e == plen) {
+      out[o++] = '/';
+    }
+    i = e;
+  }
+  if (o == 0) {
+    out[o++] = '/';
+  }
+  out[o] = '\0';
+
+  for (i = 0; host[i] && i < sizeof(hostl) - 1; i++) {
+    hostl[i] = tolower((unsigned char)host[i]);
+  }
+  hostl[i] = '\0';
+  long pn = strtol(port, &end, 10);
+  if (*end != '\0') {
+    snprintf(portpart, sizeof(portpart), ":%s", port);
+  }
+  else if (pn != 80) {
+    snprintf(portpart, sizeof(portpart), ":%ld", pn);
+  }
+  snprintf(key, cap, "http://%s%s%s%s", hostl, portpart, out, norm + plen);
+}
+
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg) {
-  char buf[MAXLINE], body[MAXLINE];
+  char buf[MAXLINE * 2];
+  int n = format_error(buf, cause, errnum, shortmsg, longmsg);
+
+  // 클라이언트가 이미 끊었어도 프록시가 죽으면 안 되니까 rio_writen
+  rio_writen(fd, buf, n);
+}
+
+/* 에러 응답(헤더 + body)을 buf에 만들어서 길이를 돌려준다. buf는 MAXLINE * 2 이상 */
+int format_error(char *buf, char *cause, char *errnum, char *shortmsg, char *longmsg) {
+  char body[MAXLINE];
+  int n = 0;
 
   /* Build HTTP reaponse body */
-  sprintf(body, "<html><title>Tiny Error</title>");
-  sprintf(body, "%s<body bgcolor=""ffffff"">\r\n", body);
-  sprintf(body, "%s%s: %s\r\n", body, errnum, shortmsg);
-  sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);
-  sprintf(body, "%s<hr><em>The Tiny Web Server</em>\r\n", body);
+  n += snprintf(body + n, sizeof(body) - n, "<html><title>Tiny Error</title>");
+  n += snprintf(body + n, sizeof(body) - n, "<body bgcolor=""ffffff"">\r\n");
+  n += snprintf(body + n, sizeof(body) - n, "%s: %s\r\n", errnum, shortmsg);
+  n += snprintf(body + n, sizeof(body) - n, "<p>%s: %.1024s\r\n", longmsg, cause);
+  n += snprintf(body + n, sizeof(body) - n, "<hr><em>The Tiny Web Server</em>\r\n");
 
   /* Print the HTTP response (body에 있는 HTTP와 관련된 내용들) */
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-  Rio_writen(fd, body, strlen(body));
+  // 에러 뒤에는 항상 연결을 닫는다 (keep-alive 클라이언트가 기다리지 않게)
+  return sprintf(buf, "HTTP/1.0 %s %s\r\n"
+                      "Connection: close\r\n"
+                      "Content-type: text/html\r\n"
+                      "Content-length: %d\r\n\r\n%s", errnum, shortmsg, n, body);
 }
 
 /*
- * Rebuild_request - 프록시가 원 서버로 보낼 요청을 재조립합니다.
- * (버퍼 오버플로우 수정됨)
+ * build_request - 재조립한 요청을 buf(REQ_BUFSIZE)에 쓰고 길이를 돌려줍니다.
+ * 소켓에 쓰는 건 호출하는 쪽 몫 (쓰레드는 rio_writen, epoll은 non-blocking write)
+ * keep이면 원 서버에 연결 유지를 요청합니다 (응답 뒤 연결을 upstream 풀에 돌려줌)
+ * raw_header는 strtok으로 잘리니까 한 번만 부를 수 있습니다.
  */
-void Rebuild_request(char *host, char *path, char *port, char *raw_header, char *host_hdr, int serverfd) {
-  
-  // char buf[MAXLINE * 4];  // [💥 문제] 이 버퍼는 너무 작습니다.
-  char buf[MAX_OBJECT_SIZE]; // [💡 해결] 버퍼 크기를 넉넉하게 늘립니다.
-  
+int build_request(char *host, char *path, char *port, char *raw_header, char *buf, int keep) {
   int n = 0;
   // 필수 헤더 4개 적기
   n += sprintf(buf + n, "GET %s HTTP/1.0\r\n", path);
@@ -341,8 +1180,13 @@ void Rebuild_request(char *host, char *path, char *port, char *raw_header, char
         n += sprintf(buf + n, "Host: %s:%s\r\n", host, port);
   
   n += sprintf(buf + n, "%s", user_agent_hdr);
-  n += sprintf(buf + n, "Connection: close\r\n");
-  n += sprintf(buf + n, "Proxy-Connection: close\r\n");
+  if (keep) {
+    n += sprintf(buf + n, "Connection: keep-alive\r\n");
+  }
+  else {
+    n += sprintf(buf + n, "Connection: close\r\n");
+    n += sprintf(buf + n, "Proxy-Connection: close\r\n");
+  }
 
   // 원본 헤더를 '\r\n'을 기준으로 쪼개기
   // strtok은 원본(raw_header)을 수정하므로 주의해야 하지만,
@@ -357,8 +1201,8 @@ void Rebuild_request(char *host, char *path, char *port, char *raw_header, char
        strncasecmp(line, "Proxy-Connection:", 17) &&
        strncasecmp(line, "Accept-Encoding:", 16)){
       
-      // 버퍼에 여유가 있는지 확인하는 것이 더 좋지만, 
-      // MAX_OBJECT_SIZE로 설정했기 때문에 웬만한 요청은 오버플로우가 나지 않습니다.
+      // 원본 헤더가 MAXLINE * 4를 넘지 않으니
+      // REQ_BUFSIZE 안에 늘 들어갑니다.
       n += sprintf(buf + n, "%s\r\n", line);
     }
     // 다음 줄로
@@ -367,9 +1211,7 @@ void Rebuild_request(char *host, char *path, char *port, char *raw_header, char
   
   // 마지막 빈 줄 추가
   n += sprintf(buf + n, "\r\n");
-  
-  // 완성된 요청 헤더를 원 서버(tiny)로 전송
-  Rio_writen(serverfd, buf, n);
+  return n;
 }
 
 void *thread(void *vargp) {
@@ -377,81 +1219,281 @@ void *thread(void *vargp) {
 
   int connfd = *((int *)vargp);
   Free(vargp);
-  doit(connfd);
+  serve_client(connfd);
   Close(connfd);
 
   return NULL;
 }
 
-void init_cache() {
-  g_cache.current_size = 0;
-  g_cache.cache_use_index = 0;
-  for (int i = 0; i < CACHE_SET_SIZE; i++) {
-    g_cache.blocks[i].valid = 0;        // 사용가능하다. 0이면 사용 가능. 1로 초기화 시켜놓기
+/* 풀 워커 : 연결 큐에서 connfd를 하나씩 꺼내서 처리. 끝나지 않고 계속 돈다 */
+void *worker(void *vargp) {
+  Pthread_detach(pthread_self());
+
+  // uring 모드면 쓰레드마다 링 하나. 못 만들면 이 쓰레드는 rio로
+  uring_t ring;
+  if (g_conf.mode == MODE_URING && uring_init(&ring, 16) == 0) {
+    t_ring = &ring;
+  }
+
+  while (1) {
+    int connfd = sbuf_remove(&g_sbuf);
+    serve_client(connfd);
+    Close(connfd);
   }
-  pthread_mutex_init(&g_cache.cache_m, NULL);
+  return NULL;
 }
 
-int cache_hit(char *uri, int clientfd) {
-  // mutex 락
-  pthread_mutex_lock(&g_cache.cache_m);
-  // 캐시 블록에서 캐시 탑색하기
-  for (int i = 0; i < CACHE_SET_SIZE; i++) {
-    if (g_cache.blocks[i].valid && !strcmp(g_cache.blocks[i].uri, uri)) {
-      g_cache.blocks[i].last_use = ++g_cache.cache_use_index;
-      // 캐시 안에 있는 값을 복사본으로 받은 뒤 넘겨주기
-      char tmp[MAX_OBJECT_SIZE];
-      size_t tmp_size = g_cache.blocks[i].size;
-      if (tmp_size > MAX_OBJECT_SIZE) {
-        tmp_size = MAX_OBJECT_SIZE;
-      }
-      memcpy(tmp, g_cache.blocks[i].data, tmp_size);
-      // I/O는 속도가 느려짐으로 unlock
-      pthread_mutex_unlock(&g_cache.cache_m);
-      // 클라이언트한테 보내기, 캐시 블록에 있는 데이터를
-      Rio_writen(clientfd, tmp, tmp_size);
+/* 재검증 작업을 큐에 넣는다. stale의 참조는 작업이 가져간다. 리턴값 : 0(넣음), -1(큐가 꽉 참) */
+static int refresh_submit(char *key, char *host, char *path, char *port, char *raw_header, cache_entry *stale) {
+  refresh_job *j;
 
-      return 1;
-    }
+  pthread_mutex_lock(&g_refresh.m);
+  if (g_refresh.len >= REFRESH_QUEUE) {
+    pthread_mutex_unlock(&g_refresh.m);
+    return -1;
+  }
+  g_refresh.len++;
+  pthread_mutex_unlock(&g_refresh.m);
+
+  j = Malloc(sizeof(refresh_job));
+  snprintf(j->key, sizeof(j->key), "%s", key);
+  snprintf(j->host, sizeof(j->host), "%s", host);
+  snprintf(j->path, sizeof(j->path), "%s", path);
+  snprintf(j->port, sizeof(j->port), "%s", port);
+  snprintf(j->raw_header, sizeof(j->raw_header), "%s", raw_header);
+  j->stale = stale;
+  j->next = NULL;
+
+  pthread_mutex_lock(&g_refresh.m);
+  if (g_refresh.tail) {
+    g_refresh.tail->next = j;
   }
-  pthread_mutex_unlock(&g_cache.cache_m);
-  // 캐시에서 적중하지 않으면 
+  else {
+    g_refresh.head = j;
+  }
+  g_refresh.tail = j;
+  pthread_cond_signal(&g_refresh.cv);
+  pthread_mutex_unlock(&g_refresh.m);
   return 0;
 }
 
-void cache_insert(char *uri, char *chebuf, size_t total_size) {
-  int min_LRU = INT_MAX;
-  int min_LRU_idx = 0;
+/* 재검증 작업을 하나씩 꺼내서 클라이언트 없이 fetch (304면 expires만, 아니면 새로 저장) */
+static void *refresher(void *vargp) {
+  Pthread_detach(pthread_self());
+
+  while (1) {
+    pthread_mutex_lock(&g_refresh.m);
+    while (!g_refresh.head) {
+      pthread_cond_wait(&g_refresh.cv, &g_refresh.m);
+    }
+    refresh_job *j = g_refresh.head;
+    if (!(g_refresh.head = j->next)) {
+      g_refresh.tail = NULL;
+    }
+    pthread_mutex_unlock(&g_refresh.m);
+
+    STAT_INC(refreshes);
+    fetch(-1, j->key, j->host, j->path, j->port, j->raw_header, 0, NULL, j->stale);
+    __atomic_store_n(&j->stale->refreshing, 0, __ATOMIC_RELEASE);
+    cache_put(j->stale);
+    Free(j);
+
+    pthread_mutex_lock(&g_refresh.m);
+    g_refresh.len--;
+    pthread_mutex_unlock(&g_refresh.m);
+  }
+  return NULL;
+}
+
+/* SIGUSR1 핸들러 : 카운터를 stderr로. 시그널 안이라 Sio 함수만 쓴다 */
+void print_stats(int sig) {
+  Sio_puts("stats requests=");
+  Sio_putl(g_stats.requests);
+  Sio_puts(" cache_hits=");
+  Sio_putl(g_stats.cache_hits);
+  Sio_puts(" uring_enters=");
+  Sio_putl(g_stats.uring_enters);
+  Sio_puts(" spliced=");
+  Sio_putl(g_stats.spliced);
+  Sio_puts(" upstream_reused=");
+  Sio_putl(g_stats.upstream_reused);
+  Sio_puts(" dns_hits=");
+  Sio_putl(g_stats.dns_hits);
+  Sio_puts(" dns_misses=");
+  Sio_putl(g_stats.dns_misses);
+  Sio_puts(" dns_refreshes=");
+  Sio_putl(g_stats.dns_refreshes);
+  Sio_puts(" connect_timeouts=");
+  Sio_putl(g_stats.connect_timeouts);
+  Sio_puts(" cache_evictions=");
+  Sio_putl(g_stats.cache_evictions);
+  Sio_puts(" coalesced=");
+  Sio_putl(g_stats.coalesced);
+  Sio_puts(" cache_stale=");
+  Sio_putl(g_stats.cache_stale);
+  Sio_puts(" revalidated=");
+  Sio_putl(g_stats.revalidated);
+  Sio_puts(" stale_served=");
+  Sio_putl(g_stats.stale_served);
+  Sio_puts(" refreshes=");
+  Sio_putl(g_stats.refreshes);
+  Sio_puts(" negative_stores=");
+  Sio_putl(g_stats.negative_stores);
+  Sio_puts(" disk_hits=");
+  Sio_putl(g_stats.disk_hits);
+  Sio_puts(" disk_stores=");
+  Sio_putl(g_stats.disk_stores);
+  Sio_puts(" disk_evictions=");
+  Sio_putl(g_stats.disk_evictions);
+  Sio_puts(" slab_pages_free=");
+  Sio_putl(slab_stats.pages_free);
+  Sio_puts(" slab_requested=");
+  Sio_putl(slab_stats.requested);
+  Sio_puts(" slab_slotted=");
+  Sio_putl(slab_stats.slotted);
+  Sio_puts(" slab_reassigned=");
+  Sio_putl(slab_stats.reassigned);
+  Sio_puts(" slab_large=");
+  Sio_putl(slab_stats.large);
+  Sio_puts("\n");
+}
 
-  for(int i = 0; i < CACHE_SET_SIZE; i++) {
-    // 비어있는 블록이 있는 경우. valid가 0인 경우 사용 가능한 곳
-    if (!g_cache.blocks[i].valid) {
-      g_cache.current_size += total_size;
+/* 캐시에 있으면 클라이언트로 보낸다. 리턴값 : 1(적중), 0(미스), -1(적중했는데 보내다 에러)
+   만료된 항목은 보내지 않고 잡은 채로 *stalep에 (재검증에 쓰고 cache_put)
+   메모리에 없으면 디스크 캐시 (큰 객체) */
+int cache_hit(char *uri, int clientfd, int *keepp, cache_entry **stalep) {
+  // 항목을 잡아 두고 캐시 저장소에서 바로 보낸다 (복사본 없음)
+  cache_entry *e = cache_get(uri);
+  int rc;
 
-      strcpy(g_cache.blocks[i].uri, uri);
-      memcpy(g_cache.blocks[i].data, chebuf, total_size);
-      g_cache.blocks[i].size = total_size;
-      g_cache.blocks[i].valid = 1;
-      g_cache.blocks[i].last_use = ++g_cache.cache_use_index;
+  if (!e) {
+    // 캐시에서 적중하지 않으면 디스크 캐시
+    return serve_disk(uri, clientfd, keepp);
+  }
+  if (__atomic_load_n(&e->expires, __ATOMIC_RELAXED) <= time(NULL)) {
+    STAT_INC(cache_stale);
+    // 만료된 음성 항목은 잡고 있을 이유가 없다 (미스로 가져오고, 또 실패하면 새 음성 항목으로 바뀜)
+    if (negative_entry(e)) {
+      cache_put(e);
+      return 0;
+    }
+    *stalep = e;
+    return 0;
+  }
+  STAT_INC(cache_hits);
+  rc = serve_entry(e, clientfd, keepp);
+  cache_put(e);
+  return rc;
+}
+
+/* 잡고 있는 항목을 클라이언트로. 리턴값 : 1(다 보냄), -1(에러)
+   헤더 길이를 아는 블록이면 *keepp에 맞는 Connection 헤더를 끼워 넣고,
+   원 서버 응답 그대로인 블록(hdr_len 0)이면 연결을 유지하지 않는다 */
+static int serve_entry(cache_entry *e, int clientfd, int *keepp) {
+  struct iovec iov[3];
+  int iovcnt = 0;
+  ssize_t n, total;
 
-      return ;
+  if (e->hdr_len == 0) {
+    *keepp = 0;
+    iov[iovcnt++] = (struct iovec){ e->data, e->size };
+  }
+  else {
+    // 헤더 (빈 줄 빼고) + Connection 헤더와 빈 줄 + 본문을 writev 한 번으로
+    char *conn = *keepp ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    iov[iovcnt++] = (struct iovec){ e->data, e->hdr_len - 2 };
+    iov[iovcnt++] = (struct iovec){ conn, strlen(conn) };
+    iov[iovcnt++] = (struct iovec){ e->data + e->hdr_len, e->size - e->hdr_len };
+  }
+  total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    total += iov[i].iov_len;
+  }
+  // 클라이언트한테 보내기, 캐시 항목에 있는 데이터를
+  n = send_iov(clientfd, iov, iovcnt);
+  return n == total ? 1 : -1;
+}
+
+/* 디스크 캐시에 있으면 클라이언트로. 리턴값 : 1(적중), 0(없음), -1(보내다 에러)
+   헤더는 읽어서 Connection 헤더를 끼워 보내고, 본문은 sendfile로 페이지 캐시에서 바로 */
+static int serve_disk(char *key, int clientfd, int *keepp) {
+  disk_hit h;
+  char *conn = *keepp ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  char *hdr;
+  off_t off;
+  int rc = -1;
+
+  if (!disk_open(key, &h)) {
+    return 0;
+  }
+  STAT_INC(disk_hits);
+  hdr = Malloc(h.hdr_len);
+  if (pread(h.fd, hdr, h.hdr_len, 0) == (ssize_t)h.hdr_len) {
+    struct iovec iov[2] = { { hdr, h.hdr_len - 2 }, { conn, strlen(conn) } };
+    if (send_iov(clientfd, iov, 2) == (ssize_t)(h.hdr_len - 2 + strlen(conn))) {
+      for (off = h.hdr_len; off < (off_t)h.size; ) {
+        ssize_t n = sendfile(clientfd, h.fd, &off, h.size - off);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          break;
+        }
+      }
+      rc = off == (off_t)h.size ? 1 : -1;
     }
-    if (min_LRU > g_cache.blocks[i].last_use) {
-      min_LRU = g_cache.blocks[i].last_use;
-      min_LRU_idx = i;
+  }
+  Free(hdr);
+  close(h.fd);
+  return rc;
+}
+
+/* raw_header에서 클라이언트가 보낸 조건부 요청 헤더(If-Match, If-None-Match, If-Modified-Since ...)를 뺀다 */
+static void strip_conditionals(char *raw_header) {
+  char *src = raw_header, *dst = raw_header;
+
+  while (*src) {
+    char *eol = strchr(src, '\n');
+    size_t n = eol ? (size_t)(eol - src + 1) : strlen(src);
+    if (strncasecmp(src, "If-", 3)) {
+      memmove(dst, src, n);
+      dst += n;
     }
+    src += n;
   }
+  *dst = '\0';
+}
 
-  // 비어있는 블록이 없는 상태 
-  // 캐시 정보 업데이트
-  g_cache.current_size -= g_cache.blocks[min_LRU_idx].size;
-  g_cache.current_size += total_size;
+/* iov를 클라이언트로 (uring 모드면 링으로). 쓴 바이트 수, 에러면 -1 */
+static ssize_t send_iov(int fd, struct iovec *iov, int iovcnt) {
+  if (t_ring) {
+    return uring_writev(t_ring, fd, iov, iovcnt);
+  }
+  return writev_all(fd, iov, iovcnt);
+}
 
-  strcpy(g_cache.blocks[min_LRU_idx].uri, uri);
-  memcpy(g_cache.blocks[min_LRU_idx].data, chebuf, total_size);
-  g_cache.blocks[min_LRU_idx].size = total_size;
-  g_cache.blocks[min_LRU_idx].valid = 1;
-  g_cache.blocks[min_LRU_idx].last_use = ++g_cache.cache_use_index;
+/* iov를 끝까지 쓴다 (짧게 써지면 남은 부분부터 다시). 쓴 바이트 수, 에러면 -1 */
+static ssize_t writev_all(int fd, struct iovec *iov, int iovcnt) {
+  ssize_t total = 0, n;
 
-  return;
-}
\ No newline at end of file
+  while (iovcnt > 0) {
+    if ((n = writev(fd, iov, iovcnt)) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    total += n;
+    // 다 쓴 조각은 넘기고 걸친 조각은 앞을 잘라낸다
+    while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return total;
+}
@@ -0,0 +1,112 @@
+/*
+ * proxy.h - proxy.c와 이벤트 엔진(event.c)이 같이 쓰는 설정값과 함수들
+ */
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#include "csapp.h"
+
+/* Recommended max cache and object sizes */
+#define MAX_CACHE_SIZE 1049000
+#define MAX_OBJECT_SIZE 102400
+
+// 동시성 모델 : 연결마다 쓰레드(thread), 미리 만든 쓰레드 풀(pool),
+// 코어마다 이벤트 루프 하나씩 돌리는 non-blocking epoll(epoll)
+#define MODE_THREAD 0
+#define MODE_POOL   1
+#define MODE_EPOLL  2
+#define MODE_URING  3   // 쓰레드 풀 + io_uring으로 accept / 중계
+
+// 캐시 교체 정책 (-p)
+#define POLICY_LRU     0
+#define POLICY_CLOCK   1
+#define POLICY_TINYLFU 2
+#define POLICY_ARC     3
+#define POLICY_S3FIFO  4
+
+#define DEFAULT_NTHREADS 16
+#define DEFAULT_SBUFSIZE 64
+#define DEFAULT_KA_IDLE  5     // keep-alive 연결이 다음 요청을 기다리는 시간 (초)
+#define DEFAULT_KA_MAX   100   // 연결 하나로 받는 최대 요청 수
+#define DEFAULT_UP_MAX   8     // 원 서버 (host, port)마다 풀에 두는 유휴 연결 수
+#define DEFAULT_UP_IDLE  30    // 풀의 유휴 연결을 닫기까지 (초)
+#define DEFAULT_DNS_TTL  60    // 원 서버 주소를 기억하는 시간 (초)
+#define DEFAULT_CONNECT_MS 3000 // 원 서버 connect 기한 (밀리초)
+#define DEFAULT_CACHE_SHARDS 8 // 캐시 샤드 수 (샤드마다 락 하나)
+#define DEFAULT_CACHE_TTL 300  // 수명 정보(Cache-Control, Expires, Last-Modified)가 없는 응답을 신선하다고 보는 시간 (초)
+#define DEFAULT_CACHE_GRACE 10 // 만료된 항목을 보내면서 백그라운드로 재검증하는 유예 시간 (초)
+#define REFRESH_THREADS 2      // 백그라운드 재검증 쓰레드 수
+#define REFRESH_QUEUE   64     // 밀린 재검증이 이보다 많으면 안 넣는다 (다음 적중이 다시 시도)
+#define DEFAULT_DISK_BYTES (256L * 1024 * 1024) // 디스크 캐시 바이트 예산 (-d를 줬을 때)
+#define DEFAULT_SNAP_SECS 60   // 캐시 스냅샷 저장 주기 (초, -f를 줬을 때)
+#define DEFAULT_NEG_TTL   10   // 음성 캐시 (원 서버 실패, 404 / 410)를 기억하는 시간 (초)
+
+// 재조립한 요청이 들어가는 버퍼 크기 (헤더 원본 MAXLINE * 4 + 필수 헤더(Host까지 MAXLINE) + path + 조건부 헤더)
+#define REQ_BUFSIZE (MAXLINE * 4 + MAXLINE * 3)
+
+// 시작할 때 옵션으로 정하는 설정값
+typedef struct {
+  int mode;         // MODE_THREAD / MODE_POOL / MODE_EPOLL
+  int nthreads;     // 풀 쓰레드 개수
+  int sbufsize;     // 연결 큐 깊이 (꽉 차면 accept 루프가 기다림)
+  int nloops;       // epoll 이벤트 루프 개수 (0이면 코어 개수)
+  int reuseport;    // 1이면 루프마다 SO_REUSEPORT 리스너 + 코어 고정
+  int splice;       // 캐시 못 하는 게 확실한 응답은 splice로 중계 (-S로 끔)
+  int ka_idle;      // 클라이언트 keep-alive 유휴 타임아웃 (초, 0이면 keep-alive 안 함)
+  int ka_max;       // 클라이언트 연결 하나당 최대 요청 수
+  int up_max;       // 원 서버마다 풀에 둘 유휴 연결 수 (0이면 풀 안 씀)
+  int up_idle;      // 풀의 유휴 연결 타임아웃 (초)
+  int dns_ttl;      // 주소 캐시 TTL (초, 0이면 매번 getaddrinfo)
+  int connect_ms;   // 원 서버 connect 기한 (밀리초)
+  long cache_bytes; // 캐시 바이트 예산
+  int cache_policy; // POLICY_LRU / CLOCK / TINYLFU / ARC / S3FIFO
+  int cache_shards; // 캐시 샤드 수
+  long cache_ttl;   // 수명 정보가 없는 응답의 수명 (초)
+  long cache_grace; // stale-while-revalidate가 없는 응답의 유예 시간 (초)
+  char *spool_dir;  // 디스크 캐시 디렉터리 (NULL이면 디스크 캐시 안 씀)
+  long disk_bytes;  // 디스크 캐시 바이트 예산
+  char *snap_path;  // 캐시 스냅샷 파일 (NULL이면 안 씀)
+  int snap_secs;    // 스냅샷 저장 주기 (초, 0이면 끌 때만)
+  long neg_ttl;     // 음성 캐시 TTL (초, 0이면 실패와 404 / 410을 캐시 안 함)
+} conf;
+
+extern conf g_conf;
+
+// SIGUSR1을 받으면 stderr로 찍는 카운터들 (bench.sh가 읽음)
+typedef struct {
+  long requests;        // doit이 처리한 요청
+  long cache_hits;
+  long uring_enters;    // io_uring_enter 시스템 콜 횟수
+  long spliced;         // splice로 옮긴 응답 수
+  long upstream_reused; // 풀에서 꺼낸 원 서버 연결로 처리한 미스
+  long dns_hits;        // 주소 캐시 적중 (실패를 기억한 음성 항목 포함)
+  long dns_misses;      // 요청 쓰레드가 직접 getaddrinfo 한 횟수
+  long dns_refreshes;   // 백그라운드 쓰레드가 미리 다시 해석한 횟수
+  long connect_timeouts; // connect 기한 안에 어느 주소도 안 붙은 횟수
+  long cache_evictions;  // 예산을 맞추느라 내보낸 캐시 항목
+  long coalesced;        // 같은 uri를 가져오는 다른 요청을 기다린 미스 (single-flight)
+  long cache_stale;      // 찾았는데 만료된 항목
+  long revalidated;      // 만료된 항목을 원 서버가 304로 다시 신선하게 해 줌
+  long stale_served;     // 유예 시간 안이라 만료된 항목을 바로 보냄
+  long refreshes;        // 백그라운드 재검증
+  long disk_hits;        // 디스크 캐시에서 보낸 응답
+  long disk_stores;      // 디스크 캐시에 넣은 응답
+  long disk_evictions;   // 디스크 예산을 맞추느라 지운 파일
+  long negative_stores;  // 원 서버 실패로 캐시한 502 (음성 캐시)
+} proxy_stats;
+
+extern proxy_stats g_stats;
+
+#define STAT_INC(f) __atomic_add_fetch(&g_stats.f, 1, __ATOMIC_RELAXED)
+
+/* 요청 파싱 / 재조립 (proxy.c) */
+int add_header_line(char *line, char *raw_header, size_t rawcap, char *host_hdr, size_t hostcap);
+void parse_uri(char *uri, char *host, char *path, char *port, char *host_hdr);
+void cache_key(char *key, size_t cap, char *host, char *port, char *path);
+int build_request(char *host, char *path, char *port, char *raw_header, char *buf, int keep);
+int format_error(char *buf, char *cause, char *errnum, char *shortmsg, char *longmsg);
+
+/* epoll 엔진 (event.c) */
+void event_run(int listenfd, char *port, int nloops, int reuseport);
+
+#endif /* __PROXY_H__ */
@@ -0,0 +1,41 @@
+/*
+ * sbuf.c - 크기 제한 생산자/소비자 버퍼. csapp.c의 Sem_init/P/V 래퍼로 만든다
+ */
+#include "csapp.h"
+#include "sbuf.h"
+
+/* 슬롯 n개짜리 빈 공유 FIFO 버퍼를 만든다 */
+void sbuf_init(sbuf_t *sp, int n) {
+  sp->buf = Calloc(n, sizeof(int));
+  sp->n = n;
+  sp->front = sp->rear = 0;        // front == rear 이면 비어 있음
+  Sem_init(&sp->mutex, 0, 1);      // 락으로 쓰는 이진 세마포어
+  Sem_init(&sp->slots, 0, n);      // 처음엔 빈 슬롯 n개
+  Sem_init(&sp->items, 0, 0);      // 처음엔 항목 0개
+}
+
+void sbuf_deinit(sbuf_t *sp) {
+  Free(sp->buf);
+}
+
+/* item을 버퍼 뒤에 넣는다.
+   큐가 꽉 차 있으면 빈 슬롯이 생길 때까지 accept 쪽이 기다린다 */
+void sbuf_insert(sbuf_t *sp, int item) {
+  P(&sp->slots);                          // 빈 슬롯 기다림
+  P(&sp->mutex);
+  sp->buf[(++sp->rear) % (sp->n)] = item;
+  V(&sp->mutex);
+  V(&sp->items);                          // 항목 생겼다고 알림
+}
+
+/* 버퍼 앞의 항목을 꺼내서 돌려준다. 비어 있으면 기다린다 */
+int sbuf_remove(sbuf_t *sp) {
+  int item;
+
+  P(&sp->items);                          // 항목 기다림
+  P(&sp->mutex);
+  item = sp->buf[(++sp->front) % (sp->n)];
+  V(&sp->mutex);
+  V(&sp->slots);                          // 빈 슬롯 생겼다고 알림
+  return item;
+}
@@ -0,0 +1,25 @@
+/*
+ * sbuf.h - 연결 디스크립터를 담는 크기 제한 생산자/소비자 버퍼
+ *          (prethreaded server의 작업 큐, CS:APP3e 12.5.4)
+ */
+#ifndef __SBUF_H__
+#define __SBUF_H__
+
+#include "csapp.h"
+
+typedef struct {
+  int *buf;          // 슬롯 배열
+  int n;             // 슬롯 수 (큐에 들어갈 수 있는 최대 개수)
+  int front;         // 첫 항목은 buf[(front+1)%n]
+  int rear;          // 마지막 항목은 buf[rear%n]
+  sem_t mutex;       // buf 접근 보호
+  sem_t slots;       // 빈 슬롯 수
+  sem_t items;       // 들어 있는 항목 수
+} sbuf_t;
+
+void sbuf_init(sbuf_t *sp, int n);
+void sbuf_deinit(sbuf_t *sp);
+void sbuf_insert(sbuf_t *sp, int item);
+int sbuf_remove(sbuf_t *sp);
+
+#endif /* __SBUF_H__ */
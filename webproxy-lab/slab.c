@@ -0,0 +1,297 @@
+/*
+ * slab.c - 캐시 항목 전용 슬랩 할당기
+ *
+ * 항목마다 malloc / free 하던 걸, 시작할 때 캐시 예산만큼 잡아 둔 아레나에서 나눠 준다.
+ *  - 아레나는 SLAB_PAGE 크기 페이지들. 페이지 하나는 한 크기 클래스의 슬롯들로만 쪼갠다
+ *  - 크기 클래스는 SLAB_MIN부터 1.25배씩 (8바이트 정렬), 마지막은 페이지 통째
+ *  - 클래스마다 빈 슬롯이 있는 페이지 리스트(free list)를 둔다. 페이지 안의 빈 슬롯은 비트맵으로 찾음
+ *  - 페이지의 슬롯이 전부 풀리면 빈 페이지 리스트로 돌아가고, 다음에 모자란 클래스가 가져간다 (rebalancing)
+ *  - 페이지보다 큰 항목은 빈 페이지를 필요한 장수만큼 빌려(lent) 두고 힙에서 따로 잡는다.
+ *    빌린 페이지는 MADV_DONTNEED로 돌려주니 아레나 + 큰 항목의 실제 메모리는 예산 안.
+ *    페이지가 작으니 크기가 제각각인 객체가 섞여도 클래스마다 페이지 하나씩만 있으면 된다
+ *
+ * 풀린 슬롯에는 아무것도 쓰지 않는다 (free list 포인터를 슬롯 안에 두지 않음).
+ * 그래서 캐시 락을 잡은 쪽은 다시 할당되기 전까지 풀린 항목의 내용을 그대로 읽을 수 있다.
+ * 할당 / 해제는 전부 슬랩 락 안의 상수 시간 연산
+ */
+#include "slab.h"
+
+#define SLAB_MAX_CLASSES 64
+#define SLAB_BITMAP      (SLAB_PAGE / SLAB_MIN / 64)   // 페이지당 비트맵 워드 수
+
+#define SLAB_LENT        (-2)   // 큰 항목에 빌려준 페이지의 cls
+
+typedef struct slab_page {
+  int cls;                        // 크기 클래스 (-1이면 빈 페이지, SLAB_LENT면 큰 항목 몫)
+  int last_cls;                   // 마지막으로 붙었던 클래스 (reassigned 세기용, 처음엔 -1)
+  int used;                       // 할당된 슬롯 수
+  struct slab_page *prev, *next;  // 클래스의 빈 슬롯 있는 페이지 리스트, 빈 페이지 리스트, 또는 빌려준 페이지 리스트
+  uint64_t bits[SLAB_BITMAP];     // 할당된 슬롯 비트맵
+} slab_page;
+
+typedef struct {
+  size_t size;          // 슬롯 크기
+  int perpage;          // 페이지 하나에 들어가는 슬롯 수
+  slab_page *avail;     // 빈 슬롯이 있는 페이지들
+} slab_class;
+
+static struct {
+  char *arena;
+  size_t npages;
+  slab_page *pages;
+  slab_page *free_pages;
+  size_t nfree;         // free_pages 길이
+  slab_page *lent;      // 큰 항목들에 빌려준 페이지 (어느 항목 몫인지는 안 따지고 장수만 맞춤)
+  slab_class cls[SLAB_MAX_CLASSES];
+  int ncls;
+  pthread_mutex_t m;
+} g_slab;
+
+slab_stats_t slab_stats;
+
+static void list_push(slab_page **head, slab_page *pg) {
+  pg->prev = NULL;
+  pg->next = *head;
+  if (*head) {
+    (*head)->prev = pg;
+  }
+  *head = pg;
+}
+
+static void list_unlink(slab_page **head, slab_page *pg) {
+  if (pg->prev) {
+    pg->prev->next = pg->next;
+  }
+  else {
+    *head = pg->next;
+  }
+  if (pg->next) {
+    pg->next->prev = pg->prev;
+  }
+  pg->prev = pg->next = NULL;
+}
+
+/* arena_bytes를 SLAB_PAGE 단위로 내림해서 잡는다. 한 페이지도 안 되면 아무것도 할당 못 함 */
+void slab_init(size_t arena_bytes) {
+  size_t npages = arena_bytes / SLAB_PAGE;
+
+  memset(&g_slab, 0, sizeof(g_slab));
+  memset(&slab_stats, 0, sizeof(slab_stats));
+  pthread_mutex_init(&g_slab.m, NULL);
+
+  // 크기 클래스
+  for (size_t size = SLAB_MIN; size < SLAB_PAGE / 2 && g_slab.ncls < SLAB_MAX_CLASSES - 1; ) {
+    g_slab.cls[g_slab.ncls].size = size;
+    g_slab.cls[g_slab.ncls].perpage = SLAB_PAGE / size;
+    g_slab.ncls++;
+    size = (size * 5 / 4 + 7) & ~(size_t)7;
+  }
+  g_slab.cls[g_slab.ncls].size = SLAB_PAGE;
+  g_slab.cls[g_slab.ncls].perpage = 1;
+  g_slab.ncls++;
+
+  // 아레나와 페이지들 (처음엔 전부 빈 페이지). madvise하려면 페이지가 정렬돼 있어야 함
+  if (npages > 0) {
+    void *p;
+    if (posix_memalign(&p, SLAB_PAGE, npages * SLAB_PAGE) != 0) {
+      unix_error("posix_memalign error");
+    }
+    g_slab.arena = p;
+    g_slab.pages = Calloc(npages, sizeof(slab_page));
+  }
+  for (size_t i = npages; i-- > 0; ) {
+    g_slab.pages[i].cls = g_slab.pages[i].last_cls = -1;
+    list_push(&g_slab.free_pages, &g_slab.pages[i]);
+  }
+  g_slab.npages = g_slab.nfree = npages;
+  slab_stats.pages = slab_stats.pages_free = npages;
+}
+
+/* size가 들어가는 제일 작은 클래스. 페이지보다 크면 -1 */
+static int slab_class_of(size_t size) {
+  int lo = 0, hi = g_slab.ncls - 1;
+
+  if (size > SLAB_PAGE) {
+    return -1;
+  }
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (g_slab.cls[mid].size >= size) {
+      hi = mid;
+    }
+    else {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+static slab_page *page_of(void *p) {
+  return &g_slab.pages[((char *)p - g_slab.arena) / SLAB_PAGE];
+}
+
+/* 아레나 밖 (큰 항목)인지 */
+static int is_large(void *p) {
+  uintptr_t a = (uintptr_t)g_slab.arena;
+
+  return (uintptr_t)p < a || (uintptr_t)p >= a + g_slab.npages * SLAB_PAGE;
+}
+
+static size_t large_pages(size_t size) {
+  return (size + SLAB_PAGE - 1) / SLAB_PAGE;
+}
+
+/* 큰 항목 : 빈 페이지 large_pages(size)장을 빌리고 힙에서 잡는다. 빈 페이지가 모자라면 NULL */
+static void *large_alloc(size_t size) {
+  size_t n = large_pages(size);
+
+  pthread_mutex_lock(&g_slab.m);
+  if (g_slab.nfree < n) {
+    pthread_mutex_unlock(&g_slab.m);
+    return NULL;
+  }
+  for (size_t i = 0; i < n; i++) {
+    slab_page *pg = g_slab.free_pages;
+    list_unlink(&g_slab.free_pages, pg);
+    pg->cls = SLAB_LENT;
+    list_push(&g_slab.lent, pg);
+    // 내용은 0이 됨. 락 없이 읽는 쪽(cache_reclaim)에는 채우는 중인 슬롯(hash 0)으로 보인다
+    madvise(g_slab.arena + (pg - g_slab.pages) * (size_t)SLAB_PAGE, SLAB_PAGE, MADV_DONTNEED);
+  }
+  g_slab.nfree -= n;
+  slab_stats.pages_free -= n;
+  slab_stats.large++;
+  slab_stats.requested += size;
+  slab_stats.slotted += size;
+  pthread_mutex_unlock(&g_slab.m);
+  return Malloc(size);
+}
+
+/* 큰 항목을 풀고 빌린 장수만큼 빈 페이지로 돌려 놓는다 */
+static void large_free(void *p, size_t size) {
+  size_t n = large_pages(size);
+
+  Free(p);
+  pthread_mutex_lock(&g_slab.m);
+  for (size_t i = 0; i < n; i++) {
+    slab_page *pg = g_slab.lent;
+    list_unlink(&g_slab.lent, pg);
+    pg->cls = -1;
+    list_push(&g_slab.free_pages, pg);
+  }
+  g_slab.nfree += n;
+  slab_stats.pages_free += n;
+  slab_stats.large--;
+  slab_stats.requested -= size;
+  slab_stats.slotted -= size;
+  pthread_mutex_unlock(&g_slab.m);
+}
+
+/* 비트맵에서 제일 앞의 빈 슬롯을 잡는다. 빈 슬롯이 있는 페이지에서만 호출.
+   perpage를 넘는 비트는 늘 그보다 앞쪽 빈 슬롯보다 뒤라서 따로 막을 필요 없다 */
+static int bitmap_take(slab_page *pg) {
+  for (int w = 0; ; w++) {
+    if (~pg->bits[w]) {
+      int b = __builtin_ctzll(~pg->bits[w]);
+      pg->bits[w] |= 1ULL << b;
+      return w * 64 + b;
+    }
+  }
+}
+
+/* size 바이트 슬롯. 그 클래스에 빈 슬롯도 빈 페이지도 없으면 NULL (부르는 쪽이 내보내고 다시) */
+void *slab_alloc(size_t size) {
+  int c = slab_class_of(size);
+  slab_class *sc;
+  slab_page *pg;
+  int i;
+
+  if (c < 0) {
+    return large_alloc(size);
+  }
+  sc = &g_slab.cls[c];
+  pthread_mutex_lock(&g_slab.m);
+  if ((pg = sc->avail) == NULL) {
+    // 빈 페이지를 이 클래스에 붙인다
+    if ((pg = g_slab.free_pages) == NULL) {
+      pthread_mutex_unlock(&g_slab.m);
+      return NULL;
+    }
+    list_unlink(&g_slab.free_pages, pg);
+    g_slab.nfree--;
+    if (pg->last_cls >= 0 && pg->last_cls != c) {
+      slab_stats.reassigned++;
+    }
+    pg->cls = pg->last_cls = c;
+    memset(pg->bits, 0, sizeof(pg->bits));
+    list_push(&sc->avail, pg);
+    slab_stats.pages_free--;
+  }
+  i = bitmap_take(pg);
+  if (++pg->used == sc->perpage) {
+    list_unlink(&sc->avail, pg);     // 꽉 참
+  }
+  slab_stats.requested += size;
+  slab_stats.slotted += sc->size;
+  pthread_mutex_unlock(&g_slab.m);
+  return g_slab.arena + (pg - g_slab.pages) * (size_t)SLAB_PAGE + i * sc->size;
+}
+
+/* size는 slab_alloc에 줬던 크기 (통계용) */
+void slab_free(void *p, size_t size) {
+  slab_page *pg;
+  slab_class *sc;
+  int i;
+
+  if (is_large(p)) {
+    large_free(p, size);
+    return;
+  }
+  pg = page_of(p);
+  pthread_mutex_lock(&g_slab.m);
+  sc = &g_slab.cls[pg->cls];
+  i = ((char *)p - g_slab.arena) % SLAB_PAGE / sc->size;
+  pg->bits[i / 64] &= ~(1ULL << (i % 64));
+  if (pg->used-- == sc->perpage) {
+    list_push(&sc->avail, pg);       // 꽉 찼던 페이지에 빈 슬롯이 생김
+  }
+  if (pg->used == 0) {
+    // 페이지가 통째로 비었으면 어느 클래스든 가져갈 수 있게 돌려 놓는다
+    list_unlink(&sc->avail, pg);
+    pg->cls = -1;
+    list_push(&g_slab.free_pages, pg);
+    g_slab.nfree++;
+    slab_stats.pages_free++;
+  }
+  slab_stats.requested -= size;
+  slab_stats.slotted -= sc->size;
+  pthread_mutex_unlock(&g_slab.m);
+}
+
+/* p를 풀면 size 할당에 쓸 수 있는 슬롯이 생기는지 (같은 크기 클래스인지).
+   큰 항목을 풀면 빈 페이지가 생기니 늘 그렇고, 큰 항목을 넣으려면 빈 페이지가 있어야 하니 작은 항목은 아님 */
+int slab_same_class(void *p, size_t size) {
+  if (is_large(p)) {
+    return 1;
+  }
+  return slab_class_of(size) >= 0 && page_of(p)->cls == slab_class_of(size);
+}
+
+/* p와 같은 페이지에 할당된 슬롯들을 items에 담는다 (SLAB_PAGE / SLAB_MIN개까지). 개수를 리턴 */
+int slab_page_items(void *p, void **items) {
+  slab_page *pg = page_of(p);
+  char *base = g_slab.arena + (pg - g_slab.pages) * (size_t)SLAB_PAGE;
+  int n = 0;
+
+  pthread_mutex_lock(&g_slab.m);
+  if (pg->cls >= 0) {
+    slab_class *sc = &g_slab.cls[pg->cls];
+    for (int i = 0; i < sc->perpage; i++) {
+      if (pg->bits[i / 64] & (1ULL << (i % 64))) {
+        items[n++] = base + i * sc->size;
+      }
+    }
+  }
+  pthread_mutex_unlock(&g_slab.m);
+  return n;
+}
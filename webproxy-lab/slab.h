@@ -0,0 +1,31 @@
+/*
+ * slab.h - 캐시 항목 전용 크기 클래스 슬랩 할당기
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include "csapp.h"
+#include <stdint.h>
+
+#define SLAB_PAGE (1 << 14)   // 페이지 크기. 이보다 큰 항목은 빈 페이지 몇 장 몫을 빌려서 따로 잡는다
+#define SLAB_MIN  64          // 제일 작은 크기 클래스
+
+// SIGUSR1에서 찍는 슬랩 상태 (락 없이 읽으니 대략적인 값)
+typedef struct {
+  long pages;         // 아레나 페이지 수
+  long pages_free;    // 어느 크기 클래스에도 안 붙은 페이지
+  long requested;     // 할당된 슬롯들이 실제로 요청한 바이트 합
+  long slotted;       // 할당된 슬롯 크기 합 (slotted - requested가 내부 단편화)
+  long reassigned;    // 비워진 페이지가 다른 크기 클래스로 넘어간 횟수
+  long large;         // 페이지보다 커서 따로 잡은 항목 수
+} slab_stats_t;
+
+extern slab_stats_t slab_stats;
+
+void slab_init(size_t arena_bytes);
+void *slab_alloc(size_t size);
+void slab_free(void *p, size_t size);
+int slab_same_class(void *p, size_t size);
+int slab_page_items(void *p, void **items);
+
+#endif /* __SLAB_H__ */
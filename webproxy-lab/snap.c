@@ -0,0 +1,221 @@
+/*
+ * snap.c - 메모리 캐시 스냅샷 (warm restart)
+ *
+ * 다시 켤 때마다 캐시가 비어서 원 서버로 미스가 한꺼번에 몰린다. -f를 주면
+ *  - 저장 : -F초마다, 그리고 SIGINT / SIGTERM을 받으면 캐시 항목을 전부 파일에 쓴다.
+ *    <path>.tmp에 다 쓰고 rename하니까 쓰다 죽어도 옛 스냅샷은 멀쩡하다
+ *  - 불러오기 : 시작할 때 mmap해서 검사하고 cache_store로 다시 넣는다 (복사 한 번)
+ * 시그널은 모든 쓰레드에서 막아 두고 스냅샷 쓰레드만 sigtimedwait으로 받는다
+ * (핸들러 안에서는 캐시를 못 건드리니까)
+ *
+ * 파일 : snap_header + (snap_record + uri(NUL 포함) + data, 8바이트 맞춤) * count
+ * 검사 : magic, 버전, MAX_OBJECT_SIZE, 파일 크기, 헤더 뒤 전부의 FNV-1a, 레코드마다 범위와 키 해시.
+ * 하나라도 안 맞으면 통째로 버리고 빈 캐시로 시작한다. 만료 + 유예까지 지난 항목은 안 올린다
+ * expires는 벽시계 시각이라 꺼져 있던 동안도 그대로 센다
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "cache.h"
+#include "snap.h"
+
+#define SNAP_MAGIC   "PXSNAP1\n"
+#define SNAP_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t max_object;   // 저장할 때의 MAX_OBJECT_SIZE (다르면 안 올림)
+  uint64_t count;        // 레코드 수
+  uint64_t bytes;        // 파일 전체 크기
+  uint64_t sum;          // 헤더 뒤 전부의 FNV-1a
+} snap_header;
+
+typedef struct {
+  uint64_t hash;         // cache_hash(uri). 불러올 때 다시 계산해서 맞춰 본다
+  uint64_t size, hdr_len;
+  int64_t expires, grace;
+  uint32_t urilen;       // NUL 포함
+  uint32_t pad;
+} snap_record;
+
+// 저장하는 동안의 상태 (cache_walk 인자)
+typedef struct {
+  FILE *fp;
+  uint64_t count, bytes, sum;
+  time_t now;
+} snap_writer;
+
+static char g_snap_path[MAXLINE];
+static int g_snap_secs;
+
+static uint64_t fnv_update(uint64_t h, const void *buf, size_t n) {
+  const unsigned char *p = buf;
+
+  while (n-- > 0) {
+    h ^= *p++;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static int put(snap_writer *w, const void *buf, size_t n) {
+  if (fwrite(buf, 1, n, w->fp) != n) {
+    return -1;
+  }
+  w->sum = fnv_update(w->sum, buf, n);
+  w->bytes += n;
+  return 0;
+}
+
+/* cache_walk 콜백 : 항목 하나를 레코드로. 이미 유예까지 지난 건 건너뜀 */
+static int put_entry(cache_entry *e, void *arg) {
+  snap_writer *w = arg;
+  static const char zero[8];
+  snap_record r;
+  time_t expires = __atomic_load_n(&e->expires, __ATOMIC_RELAXED);
+
+  if (expires + e->grace <= w->now) {
+    return 0;
+  }
+  memset(&r, 0, sizeof(r));
+  r.hash = e->hash;
+  r.size = e->size;
+  r.hdr_len = e->hdr_len;
+  r.expires = expires;
+  r.grace = e->grace;
+  r.urilen = strlen(e->uri) + 1;
+  if (put(w, &r, sizeof(r)) < 0 || put(w, e->uri, r.urilen) < 0 || put(w, e->data, e->size) < 0 ||
+      put(w, zero, (8 - (r.urilen + r.size) % 8) % 8) < 0) {
+    return -1;
+  }
+  w->count++;
+  return 0;
+}
+
+/* snap_save - 지금 캐시를 path에 쓴다. 저장한 항목 수, 에러면 -1 (옛 파일은 그대로) */
+int snap_save(char *path) {
+  char tmp[MAXLINE + 8];
+  snap_header hdr;
+  snap_writer w = { NULL, 0, sizeof(snap_header), 14695981039346656037ULL, time(NULL) };
+  int rc;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((w.fp = fopen(tmp, "w")) == NULL) {
+    fprintf(stderr, "snapshot: %s: %s\n", tmp, strerror(errno));
+    return -1;
+  }
+  // 헤더 자리만 잡아 두고 다 쓴 뒤에 채운다
+  memset(&hdr, 0, sizeof(hdr));
+  rc = fwrite(&hdr, sizeof(hdr), 1, w.fp) == 1 ? cache_walk(put_entry, &w) : -1;
+  if (rc == 0) {
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAP_VERSION;
+    hdr.max_object = MAX_OBJECT_SIZE;
+    hdr.count = w.count;
+    hdr.bytes = w.bytes;
+    hdr.sum = w.sum;
+    if (fseek(w.fp, 0, SEEK_SET) < 0 || fwrite(&hdr, sizeof(hdr), 1, w.fp) != 1 ||
+        fflush(w.fp) != 0 || fsync(fileno(w.fp)) < 0) {
+      rc = -1;
+    }
+  }
+  if (fclose(w.fp) != 0 || rc < 0 || rename(tmp, path) < 0) {
+    fprintf(stderr, "snapshot: failed to write %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    return -1;
+  }
+  return w.count;
+}
+
+/* snap_load - path의 스냅샷을 캐시에 올린다. 올린 항목 수, 없거나 못 믿을 파일이면 -1 */
+int snap_load(char *path) {
+  struct stat st;
+  snap_header *hdr;
+  char *base;
+  size_t off;
+  time_t now = time(NULL);
+  int fd, n = 0;
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snap_header) ||
+      (base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  hdr = (snap_header *)base;
+  if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) || hdr->version != SNAP_VERSION ||
+      hdr->max_object != MAX_OBJECT_SIZE || hdr->bytes != (uint64_t)st.st_size ||
+      fnv_update(14695981039346656037ULL, base + sizeof(snap_header), st.st_size - sizeof(snap_header)) != hdr->sum) {
+    fprintf(stderr, "snapshot: %s is invalid, starting cold\n", path);
+    munmap(base, st.st_size);
+    return -1;
+  }
+  off = sizeof(snap_header);
+  for (uint64_t i = 0; i < hdr->count; i++) {
+    snap_record r;
+    char *uri, *data;
+    if (off + sizeof(r) > (size_t)st.st_size) {
+      break;
+    }
+    memcpy(&r, base + off, sizeof(r));
+    uri = base + off + sizeof(r);
+    data = uri + r.urilen;
+    if (r.urilen == 0 || r.urilen > MAXLINE || r.size > MAX_OBJECT_SIZE || r.hdr_len > r.size ||
+        (size_t)(data + r.size - base) > (size_t)st.st_size ||
+        uri[r.urilen - 1] != '\0' || strlen(uri) != r.urilen - 1 || cache_hash(uri) != r.hash) {
+      break;
+    }
+    if (r.expires + r.grace > now) {
+      cache_store(uri, data, r.size, r.hdr_len, r.expires, r.grace);
+      n++;
+    }
+    off += sizeof(r) + r.urilen + r.size;
+    off += (8 - off % 8) % 8;
+  }
+  munmap(base, st.st_size);
+  return n;
+}
+
+/* 스냅샷 쓰레드 : g_snap_secs마다 저장하고, SIGINT / SIGTERM이면 저장하고 끝낸다 */
+static void *snapshotter(void *vargp) {
+  sigset_t *set = vargp;
+  struct timespec ts = { g_snap_secs, 0 };
+
+  Pthread_detach(pthread_self());
+  while (1) {
+    int sig = g_snap_secs > 0 ? sigtimedwait(set, NULL, &ts) : sigwaitinfo(set, NULL);
+    if (sig < 0 && errno != EAGAIN) {
+      continue;     // EINTR
+    }
+    int n = snap_save(g_snap_path);
+    if (sig > 0) {
+      printf("Saved %d cache entries to %s\n", n, g_snap_path);
+      exit(0);
+    }
+  }
+  return NULL;
+}
+
+/*
+ * snap_start - path의 스냅샷을 올리고 저장 쓰레드를 띄운다. secs : 주기 (0이면 끌 때만).
+ *     시그널 마스크는 새 쓰레드에 물려지니 다른 쓰레드를 만들기 전에 불러야 한다
+ */
+void snap_start(char *path, int secs) {
+  static sigset_t set;
+  pthread_t tid;
+  int n;
+
+  snprintf(g_snap_path, sizeof(g_snap_path), "%s", path);
+  g_snap_secs = secs;
+  if ((n = snap_load(path)) >= 0) {
+    printf("Loaded %d cache entries from %s\n", n, path);
+  }
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  Pthread_create(&tid, NULL, snapshotter, &set);
+}
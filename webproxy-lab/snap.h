@@ -0,0 +1,11 @@
+/*
+ * snap.h - 메모리 캐시 스냅샷 (-f). 끌 때와 주기적으로 저장하고 시작할 때 다시 올린다
+ */
+#ifndef __SNAP_H__
+#define __SNAP_H__
+
+int snap_save(char *path);
+int snap_load(char *path);
+void snap_start(char *path, int secs);
+
+#endif /* __SNAP_H__ */
@@ -0,0 +1,158 @@
+/*
+ * upstream.c - 원 서버 연결 풀
+ *
+ * 캐시 미스마다 getaddrinfo + connect를 하던 걸, 응답을 다 받은 연결을
+ * (host, port)별로 모아뒀다가 다음 미스에 다시 쓴다.
+ *  - 원 서버 하나당 유휴 연결은 max_idle개까지 (넘치면 그냥 닫음)
+ *  - idle_secs보다 오래 놀던 연결은 닫는다 (원 서버가 먼저 닫았을 가능성이 큼)
+ *  - 꺼낼 때 poll로 한 번 더 확인. 유휴 연결에 읽을 게 있으면 EOF거나 쓰레기라 못 씀
+ */
+#include "csapp.h"
+#include "upstream.h"
+#include "dnscache.h"
+#include <poll.h>
+
+#define UPSTREAM_ORIGINS  64   // 풀을 가지는 (host, port) 개수
+#define UPSTREAM_MAX_IDLE 64   // 원 서버 하나당 유휴 연결 최대 (-u 상한)
+
+typedef struct {
+  int fd;
+  time_t since;                // 풀에 들어온 시각
+} idle_conn;
+
+typedef struct {
+  char host[256];              // 비어 있으면 안 쓰는 슬롯
+  char port[16];
+  int nidle;
+  idle_conn idle[UPSTREAM_MAX_IDLE];   // 오래된 것부터. 꺼낼 때는 끝(최근)에서
+  time_t last_use;
+} origin_pool;
+
+static origin_pool pools[UPSTREAM_ORIGINS];
+static int max_idle, idle_secs;
+static time_t last_sweep;
+static pthread_mutex_t up_m = PTHREAD_MUTEX_INITIALIZER;
+
+/* max_idle이 0이면 풀을 쓰지 않는다 (upstream_put이 바로 닫음) */
+void upstream_init(int n, int secs) {
+  max_idle = n < UPSTREAM_MAX_IDLE ? n : UPSTREAM_MAX_IDLE;
+  idle_secs = secs;
+}
+
+/* 오래 놀던 연결을 앞에서부터 닫는다. 락 잡고 호출 */
+static void expire(origin_pool *p, time_t now) {
+  int n = 0;
+
+  while (n < p->nidle && now - p->idle[n].since >= idle_secs) {
+    close(p->idle[n].fd);
+    n++;
+  }
+  if (n > 0) {
+    p->nidle -= n;
+    memmove(p->idle, p->idle + n, p->nidle * sizeof(idle_conn));
+  }
+}
+
+/* 1초에 한 번만 전체 풀을 훑는다. 락 잡고 호출 */
+static void sweep(time_t now) {
+  if (now == last_sweep) {
+    return;
+  }
+  last_sweep = now;
+  for (int i = 0; i < UPSTREAM_ORIGINS; i++) {
+    expire(&pools[i], now);
+  }
+}
+
+/* (host, port)의 풀. create면 없을 때 새로 만든다 (꽉 차면 제일 오래 안 쓴 원 서버를 비우고)
+   락 잡고 호출 */
+static origin_pool *find_pool(char *host, char *port, int create, time_t now) {
+  origin_pool *victim = NULL;
+
+  for (int i = 0; i < UPSTREAM_ORIGINS; i++) {
+    origin_pool *p = &pools[i];
+    if (!strcmp(p->host, host) && !strcmp(p->port, port)) {
+      return p;
+    }
+    if (!victim || p->host[0] == '\0' ||
+        (victim->host[0] != '\0' && p->last_use < victim->last_use)) {
+      victim = p;
+    }
+  }
+  if (!create || strlen(host) >= sizeof(victim->host) || strlen(port) >= sizeof(victim->port)) {
+    return NULL;
+  }
+  while (victim->nidle > 0) {
+    close(victim->idle[--victim->nidle].fd);
+  }
+  strcpy(victim->host, host);
+  strcpy(victim->port, port);
+  victim->last_use = now;
+  return victim;
+}
+
+/* 유휴 연결에서 읽을 게 없어야 살아 있는 것 (EOF, RST, 안 읽은 데이터 모두 탈락) */
+static int conn_alive(int fd) {
+  struct pollfd pfd = { fd, POLLIN, 0 };
+
+  return poll(&pfd, 1, 0) == 0;
+}
+
+/*
+ * upstream_get - (host, port)로 가는 연결. 풀에 살아 있는 게 있으면 그걸(*reusedp = 1),
+ *     없으면 새로 연다(*reusedp = 0, 주소는 dnscache). 실패하면 -1
+ */
+int upstream_get(char *host, char *port, int *reusedp) {
+  time_t now = time(NULL);
+
+  *reusedp = 0;
+  while (1) {
+    int fd = -1;
+    pthread_mutex_lock(&up_m);
+    sweep(now);
+    origin_pool *p = find_pool(host, port, 0, now);
+    if (p && p->nidle > 0) {
+      fd = p->idle[--p->nidle].fd;
+      p->last_use = now;
+    }
+    pthread_mutex_unlock(&up_m);
+
+    if (fd < 0) {
+      break;
+    }
+    if (conn_alive(fd)) {
+      *reusedp = 1;
+      return fd;
+    }
+    close(fd);
+  }
+  return dns_connect(host, port);
+}
+
+/*
+ * upstream_put - 응답을 끝까지 받은(다음 요청을 보내도 되는) 연결을 풀에 돌려준다.
+ *     풀이 꺼져 있거나 꽉 찼으면 닫는다
+ */
+void upstream_put(char *host, char *port, int fd) {
+  time_t now = time(NULL);
+  origin_pool *p = NULL;
+
+  if (max_idle > 0) {
+    pthread_mutex_lock(&up_m);
+    sweep(now);
+    p = find_pool(host, port, 1, now);
+    if (p && p->nidle < max_idle) {
+      p->idle[p->nidle].fd = fd;
+      p->idle[p->nidle].since = now;
+      p->nidle++;
+      p->last_use = now;
+    }
+    else {
+      p = NULL;
+    }
+    pthread_mutex_unlock(&up_m);
+  }
+  if (!p) {
+    close(fd);
+  }
+}
@@ -0,0 +1,11 @@
+/*
+ * upstream.h - 원 서버로 가는 keep-alive 연결 풀 ((host, port)마다 유휴 연결 몇 개씩)
+ */
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+void upstream_init(int max_idle, int idle_secs);
+int upstream_get(char *host, char *port, int *reusedp);
+void upstream_put(char *host, char *port, int fd);
+
+#endif /* __UPSTREAM_H__ */
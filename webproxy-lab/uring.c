@@ -0,0 +1,335 @@
+/*
+ * uring.c - io_uring I/O 엔진 (-m uring)
+ *
+ * 요청 처리(doit)는 쓰레드 풀과 똑같고, 바이트 옮기는 부분만 io_uring으로 바꾼다.
+ *  - accept : multishot accept 하나로 연결이 올 때마다 CQE가 나온다 (accept 호출 반복 X)
+ *  - 요청 전송 + 첫 recv : IOSQE_IO_LINK로 묶어서 io_uring_enter 한 번
+ *  - 중계 : "클라이언트로 send + 서버에서 다음 recv"를 한 번에 제출 (버퍼 두 개 번갈아 사용)
+ *           rio로는 8KB마다 read + write 두 번이던 걸 io_uring_enter 한 번으로
+ */
+#include "csapp.h"
+#include "proxy.h"
+#include "uring.h"
+#include "cache.h"
+#include "fresh.h"
+#include <sys/syscall.h>
+
+#define RELAY_SIZE MAXBUF
+
+// user_data로 어떤 요청의 완료인지 구분
+#define UD_SEND   1
+#define UD_RECV   2
+#define UD_ACCEPT 3
+
+static int sys_uring_setup(unsigned entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* 링 만들고 SQ/CQ를 mmap. 실패하면 -1 (커널이 막아둔 경우 등, 호출한 쪽이 rio로 돌아감) */
+int uring_init(uring_t *r, unsigned entries) {
+  struct io_uring_params p;
+  char *ring;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+  if ((r->fd = sys_uring_setup(entries, &p)) < 0) {
+    return -1;
+  }
+  // SQ 링과 CQ 링을 한 번에 mmap (5.4부터 있는 IORING_FEAT_SINGLE_MMAP만 지원)
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(r->fd);
+    return -1;
+  }
+  r->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > r->ring_sz) {
+    r->ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  }
+  r->ring_ptr = mmap(NULL, r->ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+  if (r->ring_ptr == MAP_FAILED) {
+    close(r->fd);
+    return -1;
+  }
+  r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    munmap(r->ring_ptr, r->ring_sz);
+    close(r->fd);
+    return -1;
+  }
+
+  ring = r->ring_ptr;
+  r->sq_head = (unsigned *)(ring + p.sq_off.head);
+  r->sq_tail = (unsigned *)(ring + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(ring + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(ring + p.sq_off.array);
+  r->cq_head = (unsigned *)(ring + p.cq_off.head);
+  r->cq_tail = (unsigned *)(ring + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(ring + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(ring + p.cq_off.cqes);
+  r->sq_local_tail = *r->sq_tail;
+  return 0;
+}
+
+void uring_exit(uring_t *r) {
+  munmap(r->sqes, r->sqes_sz);
+  munmap(r->ring_ptr, r->ring_sz);
+  close(r->fd);
+}
+
+/* 빈 sqe 하나 (0으로 초기화됨). 링이 꽉 차 있으면 먼저 제출한다 */
+struct io_uring_sqe *uring_sqe(uring_t *r) {
+  unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+  unsigned mask = *r->sq_mask;
+
+  if (r->sq_local_tail - head > mask) {
+    uring_submit_wait(r, 0);
+  }
+  unsigned idx = r->sq_local_tail & mask;
+  struct io_uring_sqe *sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[idx] = idx;
+  r->sq_local_tail++;
+  r->to_submit++;
+  return sqe;
+}
+
+/* 모아둔 sqe를 넘기고 wait_nr개 완료될 때까지 기다린다. 시스템 콜은 이것 하나 */
+int uring_submit_wait(uring_t *r, unsigned wait_nr) {
+  int rc;
+
+  __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+  STAT_INC(uring_enters);
+  while ((rc = sys_uring_enter(r->fd, r->to_submit, wait_nr,
+                               wait_nr ? IORING_ENTER_GETEVENTS : 0)) < 0 && errno == EINTR) {
+    STAT_INC(uring_enters);
+  }
+  if (rc >= 0) {
+    r->to_submit -= rc;
+  }
+  return rc;
+}
+
+/* CQE 하나를 꺼낸다. 없으면 제출하면서 기다림 */
+int uring_wait_cqe(uring_t *r, struct io_uring_cqe *cqe) {
+  while (1) {
+    unsigned head = *r->cq_head;
+    if (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+      *cqe = r->cqes[head & *r->cq_mask];
+      __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+      return 0;
+    }
+    if (uring_submit_wait(r, 1) < 0) {
+      return -1;
+    }
+  }
+}
+
+static void prep_send(uring_t *r, int fd, void *buf, size_t n, unsigned flags) {
+  struct io_uring_sqe *sqe = uring_sqe(r);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)buf;
+  sqe->len = n;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->flags = flags;
+  sqe->user_data = UD_SEND;
+}
+
+static void prep_recv(uring_t *r, int fd, void *buf, size_t n) {
+  struct io_uring_sqe *sqe = uring_sqe(r);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)buf;
+  sqe->len = n;
+  sqe->user_data = UD_RECV;
+}
+
+/* rio_writen처럼 n바이트 다 보낼 때까지. 보낸 바이트 수, 에러면 -1 */
+ssize_t uring_writen(uring_t *r, int fd, void *buf, size_t n) {
+  struct io_uring_cqe cqe;
+  size_t off = 0;
+
+  while (off < n) {
+    prep_send(r, fd, (char *)buf + off, n - off, 0);
+    if (uring_wait_cqe(r, &cqe) < 0 || cqe.res < 0) {
+      return -1;
+    }
+    off += cqe.res;
+  }
+  return n;
+}
+
+/* writev_all의 io_uring 판 (IORING_OP_WRITEV). iov는 짧게 써지면 앞에서부터 줄어든다.
+   쓴 바이트 수, 에러면 -1 */
+ssize_t uring_writev(uring_t *r, int fd, struct iovec *iov, int iovcnt) {
+  struct io_uring_cqe cqe;
+  ssize_t total = 0;
+
+  while (iovcnt > 0) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long)iov;
+    sqe->len = iovcnt;
+    sqe->user_data = UD_SEND;
+    if (uring_wait_cqe(r, &cqe) < 0 || cqe.res < 0) {
+      return -1;
+    }
+    size_t n = cqe.res;
+    total += n;
+    while (iovcnt > 0 && n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return total;
+}
+
+/*
+ * uring_relay - 요청을 원 서버에 보내고 응답을 클라이언트로 중계한다.
+ * doit의 rio 중계 루프와 같은 일 : chebuf(cap)에 MAX_OBJECT_SIZE까지 모으고
+ * 넘치면 *is_cacheable = 0. 헤더가 다 오면 fresh_admit으로 바로 정해서 못 넣을 응답은
+ * 더 모으지 않는다 (auth : 요청에 Authorization이 있었음). f(leader의 flight, 없으면 NULL)가 있으면 못 넣게 된 순간 붙은 쪽에 알린다
+ * (각자 가져가게). 모은 바이트 수를 돌려준다 (에러면 -1)
+ */
+ssize_t uring_relay(uring_t *r, int serverfd, int clientfd, char *req, size_t reqlen,
+                    char *chebuf, size_t cap, int auth, int *is_cacheable, flight *f) {
+  char bufs[2][RELAY_SIZE];
+  struct io_uring_cqe cqe;
+  ssize_t accumulated = 0;
+  int cur = 0, rn = -1, pending, req_ok = 1, admit = -1;
+
+  *is_cacheable = 1;
+
+  // 요청 send -> 첫 recv를 링크로 묶어서 한 번에 제출
+  prep_send(r, serverfd, req, reqlen, IOSQE_IO_LINK);
+  prep_recv(r, serverfd, bufs[cur], RELAY_SIZE);
+  uring_submit_wait(r, 2);
+  for (pending = 2; pending > 0; pending--) {
+    if (uring_wait_cqe(r, &cqe) < 0) {
+      return -1;
+    }
+    if (cqe.user_data == UD_SEND && cqe.res != (int)reqlen) {
+      // 짧게 써졌으면 링크가 끊겨서 recv는 -ECANCELED로 온다. 나머지는 rio로 마저
+      if (cqe.res < 0 || rio_writen(serverfd, req + cqe.res, reqlen - cqe.res) < 0) {
+        req_ok = 0;
+      }
+    }
+    if (cqe.user_data == UD_RECV) {
+      rn = cqe.res;
+    }
+  }
+  if (!req_ok) {
+    return -1;
+  }
+  if (rn == -ECANCELED) {
+    prep_recv(r, serverfd, bufs[cur], RELAY_SIZE);
+    if (uring_wait_cqe(r, &cqe) < 0) {
+      return -1;
+    }
+    rn = cqe.res;
+  }
+
+  while (rn > 0) {
+    if (f) {
+      cache_flight_touch(f);
+    }
+    // 캐시가 아직 가능하다는 것
+    if (*is_cacheable) {
+      if (accumulated + rn <= (ssize_t)cap) {
+        memcpy(chebuf + accumulated, bufs[cur], rn);
+        accumulated += rn;
+      }
+      else {
+        *is_cacheable = 0;
+      }
+      if (*is_cacheable && admit < 0 && (admit = fresh_admit(chebuf, accumulated, auth, cap)) == 0) {
+        *is_cacheable = 0;
+      }
+      // 이번 조각에서 못 넣게 됨
+      if (!*is_cacheable && f) {
+        cache_flight_fill(f, 0, FLIGHT_FAIL);
+      }
+    }
+    // 이번 조각을 클라이언트로 send + 다음 조각을 다른 버퍼로 recv, 한 번에 제출
+    prep_send(r, clientfd, bufs[cur], rn, 0);
+    prep_recv(r, serverfd, bufs[cur ^ 1], RELAY_SIZE);
+    uring_submit_wait(r, 2);
+    int sent = -1, next = -1;
+    for (pending = 2; pending > 0; pending--) {
+      if (uring_wait_cqe(r, &cqe) < 0) {
+        return -1;
+      }
+      if (cqe.user_data == UD_SEND) {
+        sent = cqe.res;
+      }
+      else {
+        next = cqe.res;
+      }
+    }
+    if (sent < 0) {
+      return -1;   // 클라이언트가 끊음
+    }
+    if (sent < rn && uring_writen(r, clientfd, bufs[cur] + sent, rn - sent) < 0) {
+      return -1;
+    }
+    cur ^= 1;
+    rn = next;
+  }
+  return rn < 0 ? -1 : accumulated;
+}
+
+/*
+ * uring_accept_loop - multishot accept로 연결을 받아서 sbuf에 넣는다. 돌아오지 않음
+ * 커널이 multishot을 지원하지 않으면 평범한 Accept 루프로 돌아간다
+ */
+void uring_accept_loop(int listenfd, sbuf_t *sp) {
+  uring_t ring;
+  struct io_uring_cqe cqe;
+  int armed = 0;
+
+  if (uring_init(&ring, 64) < 0) {
+    fprintf(stderr, "io_uring unavailable, using accept()\n");
+    goto fallback;
+  }
+  while (1) {
+    if (!armed) {
+      struct io_uring_sqe *sqe = uring_sqe(&ring);
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = listenfd;
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->user_data = UD_ACCEPT;
+      armed = 1;
+    }
+    if (uring_wait_cqe(&ring, &cqe) < 0) {
+      unix_error("io_uring_enter error");
+    }
+    // F_MORE가 없으면 multishot이 끝난 것. 다시 걸어준다
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+      armed = 0;
+    }
+    if (cqe.res == -EINVAL) {
+      uring_exit(&ring);
+      goto fallback;
+    }
+    if (cqe.res >= 0) {
+      sbuf_insert(sp, cqe.res);
+    }
+  }
+
+fallback:
+  while (1) {
+    sbuf_insert(sp, Accept(listenfd, NULL, NULL));
+  }
+}
@@ -0,0 +1,37 @@
+/*
+ * uring.h - liburing 없이 io_uring 시스템 콜을 직접 쓰는 작은 래퍼 (-m uring)
+ */
+#ifndef __URING_H__
+#define __URING_H__
+
+#include "csapp.h"
+#include "sbuf.h"
+#include "cache.h"
+#include <linux/io_uring.h>
+
+typedef struct {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned sq_local_tail;   // 아직 커널에 안 넘긴 sqe까지 포함한 tail
+  unsigned to_submit;
+  void *ring_ptr;
+  size_t ring_sz, sqes_sz;
+} uring_t;
+
+int uring_init(uring_t *r, unsigned entries);
+void uring_exit(uring_t *r);
+struct io_uring_sqe *uring_sqe(uring_t *r);
+int uring_submit_wait(uring_t *r, unsigned wait_nr);
+int uring_wait_cqe(uring_t *r, struct io_uring_cqe *cqe);
+
+/* 프록시에서 쓰는 것들 */
+ssize_t uring_writen(uring_t *r, int fd, void *buf, size_t n);
+ssize_t uring_writev(uring_t *r, int fd, struct iovec *iov, int iovcnt);
+ssize_t uring_relay(uring_t *r, int serverfd, int clientfd, char *req, size_t reqlen,
+                    char *chebuf, size_t cap, int auth, int *is_cacheable, flight *f);
+void uring_accept_loop(int listenfd, sbuf_t *sp);
+
+#endif /* __URING_H__ */
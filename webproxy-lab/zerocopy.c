@@ -0,0 +1,147 @@
+/*
+ * zerocopy.c - splice() 중계 (tee()로 파일에 사본도)
+ *
+ * splice는 _GNU_SOURCE가 있어야 선언되는데 csapp.h의 gai_error와 충돌해서
+ * csapp.h 없이 따로 컴파일한다.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "zerocopy.h"
+
+#define SPLICE_CHUNK (64 * 1024)   // 파이프 기본 용량
+
+// 쓰레드마다 파이프 하나를 만들어 두고 계속 쓴다 (요청마다 pipe/close 안 하게)
+static __thread int t_pipe[2] = { -1, -1 };
+
+// splice_tee가 파일로 보낼 사본을 담는 두 번째 파이프
+static __thread int t_tee[2] = { -1, -1 };
+
+static void drop_pipe(void) {
+  close(t_pipe[0]);
+  close(t_pipe[1]);
+  t_pipe[0] = t_pipe[1] = -1;
+}
+
+static void drop_tee(void) {
+  close(t_tee[0]);
+  close(t_tee[1]);
+  t_tee[0] = t_tee[1] = -1;
+}
+
+/* 파이프 rfd에 든 n 바이트를 tofd로 전부. 0(성공), -1(에러) */
+static int drain(int rfd, int tofd, ssize_t n) {
+  while (n > 0) {
+    ssize_t m = splice(rfd, NULL, tofd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (m < 0 && errno == EINTR) {
+      continue;
+    }
+    if (m <= 0) {
+      return -1;
+    }
+    n -= m;
+  }
+  return 0;
+}
+
+/*
+ * splice_relay - fromfd에서 tofd로 remaining 바이트(음수면 EOF까지)를
+ *     파이프를 거쳐 splice로 옮긴다. 데이터는 커널 안에서만 움직인다.
+ *     옮긴 바이트 수, 에러면 -1
+ */
+ssize_t splice_relay(int fromfd, int tofd, long remaining) {
+  ssize_t total = 0;
+
+  if (t_pipe[0] < 0 && pipe(t_pipe) < 0) {
+    return -1;
+  }
+  while (remaining != 0) {
+    size_t want = (remaining > 0 && remaining < SPLICE_CHUNK) ? remaining : SPLICE_CHUNK;
+    ssize_t n = splice(fromfd, NULL, t_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;   // EOF
+    }
+    // 파이프에 들어간 만큼 전부 클라이언트로
+    ssize_t left = n;
+    while (left > 0) {
+      ssize_t m = splice(t_pipe[0], NULL, tofd, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (m < 0 && errno == EINTR) {
+        continue;
+      }
+      if (m <= 0) {
+        // 파이프에 찌꺼기가 남았으니 버리고 다음에 새로 만든다
+        drop_pipe();
+        return -1;
+      }
+      left -= m;
+    }
+    total += n;
+    if (remaining > 0) {
+      remaining -= n;
+    }
+  }
+  return total;
+}
+
+/*
+ * splice_tee - splice_relay처럼 옮기면서 같은 바이트를 filefd(디스크 캐시 파일)에도 쓴다.
+ *     파이프 내용을 tee로 두 번째 파이프에 복제해서 하나는 tofd로, 하나는 filefd로.
+ *     파일 쪽이 실패하면 *file_ok = 0으로 두고 tofd로는 계속 옮긴다.
+ *     옮긴 바이트 수, tofd나 fromfd 쪽 에러면 -1
+ */
+ssize_t splice_tee(int fromfd, int tofd, int filefd, long remaining, int *file_ok) {
+  ssize_t total = 0;
+
+  if (t_pipe[0] < 0 && pipe(t_pipe) < 0) {
+    return -1;
+  }
+  if (t_tee[0] < 0 && pipe(t_tee) < 0) {
+    *file_ok = 0;
+  }
+  while (remaining != 0) {
+    size_t want = (remaining > 0 && remaining < SPLICE_CHUNK) ? remaining : SPLICE_CHUNK;
+    ssize_t n = splice(fromfd, NULL, t_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return -1;
+    }
+    if (n == 0) {
+      break;   // EOF
+    }
+    // 두 번째 파이프는 매번 비우니까 n 바이트가 한 번에 다 들어간다. 덜 들어가면 파일은 포기
+    if (*file_ok) {
+      ssize_t t;
+      while ((t = tee(t_pipe[0], t_tee[1], n, 0)) < 0 && errno == EINTR)
+        ;
+      if (t != n) {
+        *file_ok = 0;
+        drop_tee();
+      }
+    }
+    if (drain(t_pipe[0], tofd, n) < 0) {
+      drop_pipe();
+      if (*file_ok) {
+        drop_tee();
+      }
+      return -1;
+    }
+    if (*file_ok && drain(t_tee[0], filefd, n) < 0) {
+      *file_ok = 0;
+      drop_tee();
+    }
+    total += n;
+    if (remaining > 0) {
+      remaining -= n;
+    }
+  }
+  return total;
+}
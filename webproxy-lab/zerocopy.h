@@ -0,0 +1,12 @@
+/*
+ * zerocopy.h - 바이트를 유저 공간으로 올리지 않고 fd끼리 옮기는 함수들
+ */
+#ifndef __ZEROCOPY_H__
+#define __ZEROCOPY_H__
+
+#include <sys/types.h>
+
+ssize_t splice_relay(int fromfd, int tofd, long remaining);
+ssize_t splice_tee(int fromfd, int tofd, int filefd, long remaining, int *file_ok);
+
+#endif /* __ZEROCOPY_H__ */